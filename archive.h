@@ -0,0 +1,550 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: archive.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the compressed archive format of the suffix array
+// package. The class archivewriter compresses arrays in blocks that can each
+// be decoded on their own, the class archivereader decodes single blocks,
+// ranges or whole arrays (on several threads) from a mapped archive.
+// Everything is defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __archive__
+#define __archive__
+
+#include <stdint.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include "flatarray.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+
+namespace ns_suffixarray {
+
+  // Maps the elements of an array to the unsigned values that are compressed.
+  // Signed values (relative child table positions) are mapped so that the smallest value
+  // (no value) becomes 0 and small values of either sign stay small.
+  template <class T>
+    class archivevalue {
+  public:
+    static uint64_t encode(T v);
+    static T decode(uint64_t v);
+  };
+
+  // Compresses a number of arrays into an archive.
+  // Every array is cut in blocks of blocksize elements. A block stores its minimum and the
+  // differences to it in as few bits as the largest difference needs (frame of reference),
+  // non-decreasing blocks (like the keys of an exception table) store their gaps that way.
+  // The archive is a block of two sections (see sectionwriter): the directory, with the
+  // start of every block, and the compressed data.
+  class archivewriter {
+  public:
+    typedef uint64_t offset_type;
+
+    // Starts an archive, count is stored for the reader to check.
+    archivewriter(offset_type count, offset_type blocksize = 65536);
+
+    // Compresses a and adds it as the next section.
+    template <class T>
+      void
+      add(const flatarray<T>& a);
+
+    // Returns the number of bytes write() writes.
+    offset_type
+      size() const;
+
+    // Writes the archive on os, with the given magic and version, returns false on failure.
+    bool
+      write(std::ostream& os, const char* magic, uint32_t version) const;
+
+  private:
+    // Compresses the m values at v.
+    void
+      encodeblock(const uint64_t* v, offset_type m);
+
+    void
+      putvarint(uint64_t v);
+
+    // Appends the lowest width bits of v to the data.
+    void
+      putbits(uint64_t v, unsigned int width, uint64_t& acc, unsigned int& used);
+
+    // Returns the directory as written.
+    std::vector<uint64_t>
+      getdirectory() const;
+
+    offset_type count;
+    offset_type blocksize;
+    // Per section: number of elements, size of an element and first block.
+    std::vector<uint64_t> sections;
+    // The start of every block in data.
+    std::vector<uint64_t> offsets;
+    std::vector<unsigned char> data;
+  };
+
+  // Reads an archive written by archivewriter, from a mapped file, without decoding anything
+  // up front. Blocks are decoded when asked for, whole sections on the given number of threads.
+  class archivereader {
+  public:
+    typedef uint64_t offset_type;
+
+    // Reads the directory of the archive at offset of m, checking magic and version.
+    // On failure a message is written to std::cerr and good() returns false.
+    archivereader(const mappedfile& m, offset_type offset, const char* magic, uint32_t version, unsigned int threads = 1);
+
+    bool
+      good() const { return ok; };
+
+    // Returns the count given to the writer.
+    offset_type
+      getcount() const { return count; };
+
+    // Returns the number of sections.
+    offset_type
+      sections() const { return ok ? directory[1] : 0; };
+
+    // Returns the number of elements of section i.
+    offset_type
+      elements(offset_type i) const { return directory[2 + 3*i]; };
+
+    // Returns the number of blocks of section i.
+    offset_type
+      blocks(offset_type i) const { return (elements(i) + blocksize - 1) / blocksize; };
+
+    // Returns the number of elements per block.
+    offset_type
+      getblocksize() const { return blocksize; };
+
+    // Returns the number of bytes of the archive.
+    offset_type
+      size() const { return bytes; };
+
+    // Decodes section i into a (which then owns its elements), returns false if the
+    // elements of the section are not of type T.
+    template <class T>
+      bool
+      view(offset_type i, flatarray<T>& a) const;
+
+    // Decodes elements [from,to) of section i into out, decoding only the blocks needed.
+    template <class T>
+      bool
+      extract(offset_type i, offset_type from, offset_type to, std::vector<T>& out) const;
+
+    // Decodes block b of section i into out, which must have room for the block.
+    template <class T>
+      void
+      decodeblock(offset_type i, offset_type b, T* out) const;
+
+  private:
+    // Decodes blocks of one section on a workstealingpool.
+    template <class T>
+      class blockdecoder
+      {
+      public:
+        blockdecoder(const archivereader& r, offset_type i, T* o): reader(r), section(i), out(o) {};
+        void operator()(const offset_type& b, unsigned int) { reader.decodeblock(section, b, out + b * reader.blocksize); };
+      private:
+        const archivereader& reader;
+        offset_type section;
+        T* out;
+      };
+
+    static uint64_t
+      getvarint(const unsigned char*& p);
+
+    // Keeps the archive mapped.
+    mappedfile file;
+    std::vector<uint64_t> directory;
+    const unsigned char* data;
+    offset_type count;
+    offset_type blocksize;
+    offset_type bytes;
+    unsigned int threads;
+    bool ok;
+  };
+
+	//
+	// archivevalue functions:
+	//
+
+	template <class T>
+	uint64_t
+	archivevalue<T>::encode(T v)
+	{
+		if(!std::numeric_limits<T>::is_signed)
+		{
+			return (uint64_t) v;
+		}
+		long x = (long) v;
+		if(x == (long) std::numeric_limits<T>::min())
+		{
+			return 0;
+		}
+		return (x >= 0 ? 2 * (uint64_t) x : 2 * (uint64_t) -x - 1) + 1;
+	}
+
+	template <class T>
+	T
+	archivevalue<T>::decode(uint64_t v)
+	{
+		if(!std::numeric_limits<T>::is_signed)
+		{
+			return (T) v;
+		}
+		if(v == 0)
+		{
+			return std::numeric_limits<T>::min();
+		}
+		uint64_t z = v - 1;
+		return (T) (z & 1 ? -(long) ((z + 1) / 2) : (long) (z / 2));
+	}
+
+	//
+	// archivewriter functions:
+	//
+
+	inline
+	archivewriter::archivewriter(offset_type c, offset_type b): count(c), blocksize(b < 64 ? 64 : b)
+	{
+	}
+
+	template <class T>
+	void
+	archivewriter::add(const flatarray<T>& a)
+	{
+		sections.push_back(a.size());
+		sections.push_back(sizeof(T));
+		sections.push_back(offsets.size());
+		std::vector<uint64_t> v;
+		for(offset_type b = 0; b < a.size(); b += blocksize)
+		{
+			offset_type m = std::min(blocksize, (offset_type) a.size() - b);
+			v.resize(m);
+			for(offset_type i = 0; i < m; i++)
+			{
+				v[i] = archivevalue<T>::encode(a[b + i]);
+			}
+			offsets.push_back(data.size());
+			encodeblock(&v[0], m);
+		}
+	}
+
+	inline
+	void
+	archivewriter::encodeblock(const uint64_t* v, offset_type m)
+	{
+		// Frame of reference on the values, or on the gaps if they never decrease.
+		uint64_t lo = v[0], hi = v[0];
+		uint64_t dlo = (uint64_t) -1, dhi = 0;
+		bool sorted = true;
+		for(offset_type i = 1; i < m; i++)
+		{
+			lo = std::min(lo, v[i]);
+			hi = std::max(hi, v[i]);
+			if(v[i] < v[i-1])
+			{
+				sorted = false;
+			}
+			else
+			{
+				dlo = std::min(dlo, v[i] - v[i-1]);
+				dhi = std::max(dhi, v[i] - v[i-1]);
+			}
+		}
+		unsigned int width = 0;
+		while(width < 64 && ((hi - lo) >> width) != 0)
+		{
+			width++;
+		}
+		unsigned int dwidth = 0;
+		while(sorted && m > 1 && dwidth < 64 && ((dhi - dlo) >> dwidth) != 0)
+		{
+			dwidth++;
+		}
+		bool delta = sorted && m > 1 && dwidth < width;
+		data.push_back(delta ? 1 : 0);
+		data.push_back((unsigned char) (delta ? dwidth : width));
+		uint64_t acc = 0;
+		unsigned int used = 0;
+		if(delta)
+		{
+			putvarint(dlo);
+			putvarint(v[0]);
+			for(offset_type i = 1; i < m; i++)
+			{
+				putbits(v[i] - v[i-1] - dlo, dwidth, acc, used);
+			}
+		}
+		else
+		{
+			putvarint(lo);
+			for(offset_type i = 0; i < m; i++)
+			{
+				putbits(v[i] - lo, width, acc, used);
+			}
+		}
+		if(used > 0)
+		{
+			data.push_back((unsigned char) acc);
+		}
+	}
+
+	inline
+	void
+	archivewriter::putvarint(uint64_t v)
+	{
+		while(v >= 128)
+		{
+			data.push_back((unsigned char) (v | 128));
+			v >>= 7;
+		}
+		data.push_back((unsigned char) v);
+	}
+
+	inline
+	void
+	archivewriter::putbits(uint64_t v, unsigned int width, uint64_t& acc, unsigned int& used)
+	{
+		// acc holds less than 8 bits between calls, add at most 32 bits at a time.
+		while(width > 0)
+		{
+			unsigned int n = std::min(width, 32u);
+			acc |= (v & (((uint64_t) 1 << n) - 1)) << used;
+			used += n;
+			v = n < 64 ? v >> n : 0;
+			width -= n;
+			while(used >= 8)
+			{
+				data.push_back((unsigned char) acc);
+				acc >>= 8;
+				used -= 8;
+			}
+		}
+	}
+
+	inline
+	std::vector<uint64_t>
+	archivewriter::getdirectory() const
+	{
+		// blocksize, number of sections, (elements, element size, first block) per section,
+		// the start of every block and the size of the data.
+		std::vector<uint64_t> uit;
+		uit.push_back(blocksize);
+		uit.push_back(sections.size() / 3);
+		uit.insert(uit.end(), sections.begin(), sections.end());
+		uit.insert(uit.end(), offsets.begin(), offsets.end());
+		uit.push_back(data.size());
+		return uit;
+	}
+
+	inline
+	archivewriter::offset_type
+	archivewriter::size() const
+	{
+		std::vector<uint64_t> dir = getdirectory();
+		sectionwriter w("", 0, 0, 0);
+		w.add(&dir[0], dir.size() * sizeof(uint64_t));
+		w.add(data.empty() ? 0 : &data[0], data.size());
+		return w.size();
+	}
+
+	inline
+	bool
+	archivewriter::write(std::ostream& os, const char* magic, uint32_t version) const
+	{
+		std::vector<uint64_t> dir = getdirectory();
+		sectionwriter w(magic, version, sizeof(uint64_t), count);
+		w.add(&dir[0], dir.size() * sizeof(uint64_t));
+		w.add(data.empty() ? 0 : &data[0], data.size());
+		return w.write(os);
+	}
+
+	//
+	// archivereader functions:
+	//
+
+	inline
+	archivereader::archivereader(const mappedfile& m, offset_type offset, const char* magic, uint32_t version, unsigned int t):
+		file(m), data(0), count(0), blocksize(0), bytes(0), threads(t), ok(false)
+	{
+		if(!m.good() || offset >= m.size())
+		{
+			return;
+		}
+		sectionreader r(m.data() + offset, m.size() - offset, magic, version, sizeof(uint64_t));
+		if(!r.good())
+		{
+			return;
+		}
+		if(r.sections() != 2)
+		{
+			std::cerr << "Archive is damaged" << std::endl;
+			return;
+		}
+		offset_type dirbytes, databytes;
+		const char* dir = r.section(0, dirbytes);
+		data = (const unsigned char*) r.section(1, databytes);
+		directory.resize(dirbytes / sizeof(uint64_t));
+		std::copy(dir, dir + directory.size() * sizeof(uint64_t), (char*) (directory.empty() ? 0 : &directory[0]));
+		// Check that the directory is complete and its blocks lie within the data.
+		if(directory.size() < 3 || directory.size() < 2 + 3 * directory[1] + 1 || directory[0] == 0)
+		{
+			std::cerr << "Archive is damaged" << std::endl;
+			return;
+		}
+		blocksize = directory[0];
+		offset_type total = 0;
+		for(offset_type i = 0; i < directory[1]; i++)
+		{
+			total += (directory[2 + 3*i] + blocksize - 1) / blocksize;
+		}
+		if(directory.size() != 2 + 3 * directory[1] + total + 1 || directory.back() != databytes)
+		{
+			std::cerr << "Archive is damaged" << std::endl;
+			return;
+		}
+		count = r.getcount();
+		bytes = r.size();
+		ok = true;
+	}
+
+	template <class T>
+	bool
+	archivereader::view(offset_type i, flatarray<T>& a) const
+	{
+		if(!ok || i >= sections() || directory[3 + 3*i] != sizeof(T))
+		{
+			return false;
+		}
+		a.assign(elements(i), T());
+		if(a.empty())
+		{
+			return true;
+		}
+		if(threads <= 1 || blocks(i) == 1)
+		{
+			for(offset_type b = 0; b < blocks(i); b++)
+			{
+				decodeblock(i, b, a.begin() + b * blocksize);
+			}
+			return true;
+		}
+		blockdecoder<T> f(*this, i, a.begin());
+		workstealingpool<offset_type> pool(threads);
+		for(offset_type b = 0; b < blocks(i); b++)
+		{
+			pool.push((unsigned int) (b % threads), b);
+		}
+		pool.run(f);
+		return true;
+	}
+
+	template <class T>
+	bool
+	archivereader::extract(offset_type i, offset_type from, offset_type to, std::vector<T>& out) const
+	{
+		out.clear();
+		if(!ok || i >= sections() || directory[3 + 3*i] != sizeof(T) || from > to || to > elements(i))
+		{
+			return false;
+		}
+		std::vector<T> block(blocksize);
+		for(offset_type b = from / blocksize; b * blocksize < to; b++)
+		{
+			decodeblock(i, b, &block[0]);
+			offset_type first = std::max(from, b * blocksize);
+			offset_type last = std::min(to, (b + 1) * blocksize);
+			out.insert(out.end(), block.begin() + (first - b * blocksize), block.begin() + (last - b * blocksize));
+		}
+		return true;
+	}
+
+	template <class T>
+	void
+	archivereader::decodeblock(offset_type i, offset_type b, T* out) const
+	{
+		offset_type m = std::min(blocksize, elements(i) - b * blocksize);
+		offset_type first = directory[4 + 3*i];
+		const unsigned char* p = data + directory[2 + 3 * directory[1] + first + b];
+		bool delta = *p++ == 1;
+		unsigned int width = *p++;
+		uint64_t base = getvarint(p);
+		uint64_t prev = 0;
+		offset_type i0 = 0;
+		if(delta)
+		{
+			prev = getvarint(p);
+			out[0] = archivevalue<T>::decode(prev);
+			i0 = 1;
+		}
+		uint64_t acc = 0;
+		unsigned int avail = 0;
+		for(offset_type k = i0; k < m; k++)
+		{
+			uint64_t v = 0;
+			unsigned int got = 0;
+			while(got < width)
+			{
+				if(avail == 0)
+				{
+					acc = *p++;
+					avail = 8;
+				}
+				unsigned int n = std::min(width - got, avail);
+				v |= (acc & ((1u << n) - 1)) << got;
+				acc >>= n;
+				avail -= n;
+				got += n;
+			}
+			v += base;
+			if(delta)
+			{
+				prev += v;
+				v = prev;
+			}
+			out[k] = archivevalue<T>::decode(v);
+		}
+	}
+
+	inline
+	uint64_t
+	archivereader::getvarint(const unsigned char*& p)
+	{
+		uint64_t v = 0;
+		unsigned int shift = 0;
+		while(*p & 128)
+		{
+			v |= (uint64_t) (*p++ & 127) << shift;
+			shift += 7;
+		}
+		v |= (uint64_t) (*p++) << shift;
+		return v;
+	}
+
+}
+#endif // __archive__
+// end of file: archive.h
@@ -0,0 +1,312 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: bitvector.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the class bitvector, a vector of bits that counts the
+// set bits before any position (rank) in constant time, and the class
+// exceptiontable, which stores values at a few positions of a large range
+// and finds them by rank.
+// Both are defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __bitvector__
+#define __bitvector__
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include "flatarray.h"
+
+namespace ns_suffixarray {
+
+  // A vector of bits with rank support.
+  // Set the bits first, then call buildrank() once before using rank().
+  // The rank directory takes one size_type per 512 bits.
+  class bitvector {
+  public:
+    typedef std::vector<uint64_t>::size_type size_type;
+
+    // Creates a bitvector of n bits, all 0.
+    bitvector(size_type n = 0): bits((n + 63) / 64, 0), n(n) {};
+
+    // Uses the words and rank directory written from getbits() and getranks() (views stay
+    // views). The size becomes a multiple of 64. Returns false if they do not belong together.
+    bool
+      assign(const flatarray<uint64_t>& b, const flatarray<size_type>& r);
+
+    // Returns the number of bits.
+    size_type
+      size() const { return n; };
+
+    // Sets bit i to v.
+    void
+      set(size_type i, bool v = true);
+
+    // Returns bit i.
+    bool
+      operator[](size_type i) const { return (bits[i / 64] >> (i % 64)) & 1; };
+
+    // Counts the set bits in all words, needed before rank() can be used.
+    void
+      buildrank();
+
+    // Returns the number of set bits in [0,i).
+    size_type
+      rank(size_type i) const;
+
+    // The words of bits and the rank directory.
+    const flatarray<uint64_t>&
+      getbits() const { return bits; };
+
+    const flatarray<size_type>&
+      getranks() const { return ranks; };
+
+  private:
+    // Number of words counted by one entry of the rank directory.
+    static const size_type blockwords = 8;
+
+    flatarray<uint64_t> bits;
+    // ranks[b] is the number of set bits before word b * blockwords.
+    flatarray<size_type> ranks;
+    size_type n;
+  };
+
+  // Values of type T stored at some positions of a large range, typically the few values that
+  // do not fit in a byte array. Values are appended to a log while the table is build; freeze()
+  // turns that into a bitvector marking the positions and an array with their values in
+  // position order, so get(pos) is values[rank(pos)]: two cache lines and no search.
+  // A later set() of a position overrides the earlier ones. Setting a position in a frozen
+  // table thaws it first, get() on a table that is not frozen scans the log.
+  template <class T>
+    class exceptiontable {
+  public:
+    typedef bitvector::size_type size_type;
+
+    exceptiontable(): frozen(true) {};
+
+    // Stores value at pos.
+    void
+      set(size_type pos, const T& value);
+
+    // Returns the value at pos, which must have been set.
+    const T&
+      get(size_type pos) const;
+
+    // Returns the number of values, once frozen.
+    size_type
+      size() const { return frozen ? values.size() : log.size(); };
+
+    // Moves the log into the bitvector and the value array.
+    void
+      freeze() { freeze(keepall); };
+
+    // Same, keeping only the positions for which keep(pos) is true, for positions whose
+    // value was later stored somewhere else.
+    template <class K>
+      void
+      freeze(const K& keep);
+
+    // Uses positions and values as written from getpositions() and getvalues() (views stay
+    // views), returns false if they do not belong together.
+    bool
+      assign(const bitvector& p, const flatarray<T>& v);
+
+    // The positions and their values, empty unless frozen.
+    const bitvector&
+      getpositions() const { return positions; };
+
+    const flatarray<T>&
+      getvalues() const { return values; };
+
+  private:
+    // Orders the log on position, keeping the order of sets of the same position.
+    static bool
+      before(const std::pair<size_type,T>& a, const std::pair<size_type,T>& b) { return a.first < b.first; };
+
+    static bool
+      keepall(size_type) { return true; };
+
+    std::vector< std::pair<size_type,T> > log;
+    bitvector positions;
+    flatarray<T> values;
+    bool frozen;
+  };
+
+	//
+	// bitvector functions:
+	//
+
+	inline
+	void
+	bitvector::set(size_type i, bool v)
+	{
+		uint64_t mask = (uint64_t) 1 << (i % 64);
+		if(v)
+		{
+			bits[i / 64] |= mask;
+		}
+		else
+		{
+			bits[i / 64] &= ~mask;
+		}
+	}
+
+	inline
+	void
+	bitvector::buildrank()
+	{
+		ranks.assign(bits.size() / blockwords + 1, 0);
+		size_type count = 0;
+		for(size_type w = 0; w < bits.size(); w++)
+		{
+			if(w % blockwords == 0)
+			{
+				ranks[w / blockwords] = count;
+			}
+			count += __builtin_popcountll(bits[w]);
+		}
+		if(bits.size() % blockwords == 0)
+		{
+			ranks[bits.size() / blockwords] = count;
+		}
+	}
+
+	inline
+	bool
+	bitvector::assign(const flatarray<uint64_t>& b, const flatarray<size_type>& r)
+	{
+		if(!(b.empty() && r.empty()) && r.size() != b.size() / blockwords + 1)
+		{
+			return false;
+		}
+		bits = b;
+		ranks = r;
+		n = b.size() * 64;
+		return true;
+	}
+
+	inline
+	bitvector::size_type
+	bitvector::rank(size_type i) const
+	{
+		size_type w = i / 64;
+		size_type uit = ranks[w / blockwords];
+		for(size_type b = w - w % blockwords; b < w; b++)
+		{
+			uit += __builtin_popcountll(bits[b]);
+		}
+		if(i % 64 != 0)
+		{
+			uit += __builtin_popcountll(bits[w] & (((uint64_t) 1 << (i % 64)) - 1));
+		}
+		return uit;
+	}
+
+	//
+	// exceptiontable functions:
+	//
+
+	template <class T>
+	void
+	exceptiontable<T>::set(size_type pos, const T& value)
+	{
+		if(frozen)
+		{
+			const flatarray<uint64_t>& words = positions.getbits();
+			size_type k = 0;
+			for(size_type w = 0; w < words.size(); w++)
+			{
+				for(uint64_t b = words[w]; b != 0; b &= b - 1)
+				{
+					log.push_back(std::pair<size_type,T>(w * 64 + __builtin_ctzll(b), values[k++]));
+				}
+			}
+			positions = bitvector();
+			values.clear();
+			frozen = false;
+		}
+		log.push_back(std::pair<size_type,T>(pos, value));
+	}
+
+	template <class T>
+	const T&
+	exceptiontable<T>::get(size_type pos) const
+	{
+		if(frozen)
+		{
+			return values[positions.rank(pos)];
+		}
+		size_type i = log.size();
+		while(i > 0 && log[i-1].first != pos)
+		{
+			i--;
+		}
+		return log[i-1].second;
+	}
+
+	template <class T>
+	template <class K>
+	void
+	exceptiontable<T>::freeze(const K& keep)
+	{
+		if(frozen)
+		{
+			return;
+		}
+		std::stable_sort(log.begin(), log.end(), before);
+		positions = bitvector(log.empty() ? 0 : log.back().first + 1);
+		values.clear();
+		for(size_type i = 0; i < log.size(); i++)
+		{
+			// Only the last set of a position counts.
+			if((i + 1 == log.size() || log[i+1].first != log[i].first) && keep(log[i].first))
+			{
+				positions.set(log[i].first);
+				values.push_back(log[i].second);
+			}
+		}
+		positions.buildrank();
+		std::vector< std::pair<size_type,T> >().swap(log);
+		frozen = true;
+	}
+
+	template <class T>
+	bool
+	exceptiontable<T>::assign(const bitvector& p, const flatarray<T>& v)
+	{
+		if(p.getranks().empty() ? !v.empty() : p.rank(p.size()) != v.size())
+		{
+			return false;
+		}
+		std::vector< std::pair<size_type,T> >().swap(log);
+		positions = p;
+		values = v;
+		frozen = true;
+		return true;
+	}
+
+}
+#endif // __bitvector__
+// end of file: bitvector.h
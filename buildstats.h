@@ -0,0 +1,259 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: buildstats.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the class buildstats, which records how a suffixarray
+// was build (time per phase, peak memory so far, bucket sizes and exceptions)
+// and how much work its queries did, and writes that as JSON.
+// It is defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __buildstats__
+#define __buildstats__
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+
+namespace ns_suffixarray {
+
+  // Statistics of the construction of a suffixarray and of its queries.
+  // Phases are recorded one after the other with start() and stop().
+  // Queries are only counted after countqueries(true), the counters are then shared by
+  // all threads that query.
+  class buildstats {
+  public:
+    typedef std::vector<unsigned long>::size_type size_type;
+
+    // One phase of the construction.
+    class phase
+    {
+    public:
+      std::string name;
+      // Wall clock time of the phase.
+      double seconds;
+      // Peak resident memory of the process so far, at the end of the phase, in kilobytes.
+      // This is the high-water mark of the whole process: a phase that needs less than an
+      // earlier one reports the peak of the earlier one.
+      long peaksofarkb;
+    };
+
+    buildstats(): running(false), counting(false), queries(0), expanded(0) {};
+
+    // Starts a phase, ending the running one if any.
+    void
+      start(const std::string& name);
+
+    // Ends the running phase.
+    void
+      stop();
+
+    // Returns the phases in the order they ran.
+    const std::vector<phase>&
+      getphases() const { return phases; };
+
+    // Returns the total time of the phases called name.
+    double
+      seconds(const std::string& name) const;
+
+    // Counts a bucket of the bucket sort.
+    void
+      addbucket(size_type size);
+
+    // Returns the bucket size histogram: entry k counts the buckets of size [2^k, 2^(k+1)).
+    const std::vector<size_type>&
+      getbuckets() const { return buckets; };
+
+    // Records the number of exceptions stored in the map called name.
+    void
+      setexceptions(const std::string& name, size_type count) { exceptions[name] = count; };
+
+    // Returns the number of exceptions per map.
+    const std::map<std::string,size_type>&
+      getexceptions() const { return exceptions; };
+
+    // Turns counting of queries on or off (off by default).
+    void
+      countqueries(bool on) { counting = on; };
+
+    // Counts a query that expanded the given number of lcp-intervals, if counting is on.
+    void
+      addquery(size_type intervals);
+
+    // Returns the number of queries.
+    size_type
+      getqueries() const { return (size_type) queries; };
+
+    // Returns the number of lcp-intervals expanded by all queries.
+    size_type
+      getexpanded() const { return (size_type) expanded; };
+
+    // Writes all statistics as one JSON object on os.
+    void
+      json(std::ostream& os) const;
+
+    // Writes the JSON to file f, returns false on failure.
+    bool
+      savejson(const std::string& f) const;
+
+  private:
+    std::vector<phase> phases;
+    // Start of the running phase.
+    struct timeval begin;
+    bool running;
+
+    std::vector<size_type> buckets;
+    std::map<std::string,size_type> exceptions;
+
+    bool counting;
+    volatile long queries;
+    volatile long expanded;
+  };
+
+	//
+	// buildstats functions:
+	//
+
+	inline
+	void
+	buildstats::start(const std::string& name)
+	{
+		if(!phases.empty() && running)
+		{
+			stop();
+		}
+		phase p;
+		p.name = name;
+		p.seconds = 0;
+		p.peaksofarkb = 0;
+		phases.push_back(p);
+		running = true;
+		gettimeofday(&begin, 0);
+	}
+
+	inline
+	void
+	buildstats::stop()
+	{
+		if(phases.empty() || !running)
+		{
+			return;
+		}
+		struct timeval end;
+		gettimeofday(&end, 0);
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		phases.back().seconds = (end.tv_sec - begin.tv_sec) + (end.tv_usec - begin.tv_usec) / 1e6;
+		phases.back().peaksofarkb = usage.ru_maxrss;
+		running = false;
+	}
+
+	inline
+	double
+	buildstats::seconds(const std::string& name) const
+	{
+		double uit = 0;
+		for(size_type i = 0; i < phases.size(); i++)
+		{
+			if(phases[i].name == name)
+			{
+				uit += phases[i].seconds;
+			}
+		}
+		return uit;
+	}
+
+	inline
+	void
+	buildstats::addbucket(size_type size)
+	{
+		size_type k = 0;
+		while(size > 1)
+		{
+			size >>= 1;
+			k++;
+		}
+		if(buckets.size() <= k)
+		{
+			buckets.resize(k + 1, 0);
+		}
+		buckets[k]++;
+	}
+
+	inline
+	void
+	buildstats::addquery(size_type intervals)
+	{
+		if(!counting)
+		{
+			return;
+		}
+		__sync_fetch_and_add(&queries, 1);
+		__sync_fetch_and_add(&expanded, (long) intervals);
+	}
+
+	inline
+	void
+	buildstats::json(std::ostream& os) const
+	{
+		os << "{\"phases\":[";
+		for(size_type i = 0; i < phases.size(); i++)
+		{
+			os << (i ? "," : "") << "{\"name\":\"" << phases[i].name << "\",\"seconds\":" << phases[i].seconds << ",\"peak_so_far_kb\":" << phases[i].peaksofarkb << "}";
+		}
+		os << "],\"bucket_histogram\":[";
+		for(size_type i = 0; i < buckets.size(); i++)
+		{
+			os << (i ? "," : "") << buckets[i];
+		}
+		os << "],\"exceptions\":{";
+		for(std::map<std::string,size_type>::const_iterator it = exceptions.begin(); it != exceptions.end(); ++it)
+		{
+			os << (it != exceptions.begin() ? "," : "") << "\"" << it->first << "\":" << it->second;
+		}
+		os << "},\"queries\":" << getqueries() << ",\"expanded_intervals\":" << getexpanded() << "}" << std::endl;
+	}
+
+	inline
+	bool
+	buildstats::savejson(const std::string& f) const
+	{
+		std::ofstream myfile(f.c_str());
+		if(!myfile.is_open())
+		{
+			std::cerr << "Unable to open file" << std::endl;
+			return false;
+		}
+		json(myfile);
+		return true;
+	}
+
+}
+#endif // __buildstats__
+// end of file: buildstats.h
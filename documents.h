@@ -0,0 +1,463 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: documents.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the multi-document index of the suffix array package.
+// The class documentarray builds one suffixarray on a collection of word
+// documents, every document ending in its own sentinel, and answers which
+// documents contain a query (document listing) and how often.
+// documentarray is defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __documents__
+#define __documents__
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include "wordstring.h"
+#include "tokenstring.h"
+#include "suffixarray.h"
+#include "vocabulary.h"
+#include "bitvector.h"
+
+namespace ns_suffixarray {
+
+  // Finds the position of the minimum in a range of a vector.
+  // The minimum of every block of the vector is kept in a sparse table, a query
+  // looks up the whole blocks in the table and scans the partial ones.
+  class rangemin {
+  public:
+    typedef std::vector<size_t>::size_type size_type;
+
+    // Builds the table for v, v must not change afterwards.
+    void
+      build(const std::vector<size_type>& v);
+
+    // Returns the position of the minimum of v[l..r], inclusive.
+    size_type
+      argmin(const std::vector<size_type>& v, size_type l, size_type r) const;
+
+  private:
+    // Number of elements per block.
+    static const size_type blocksize = 256;
+
+    // Returns the position of the minimum of v[l..r] by scanning.
+    static size_type
+      scan(const std::vector<size_type>& v, size_type l, size_type r);
+
+    // table[k][b] is the position of the minimum of blocks b..b+2^k-1.
+    std::vector< std::vector<size_type> > table;
+  };
+
+  // A suffixarray on a collection of documents.
+  // The documents are interned (see vocabulary) and concatenated, every document is followed
+  // by its own sentinel, an id above the ids of the words. Matches can therefore not run from
+  // one document into the next, also not through wildcards: those matches are not reported.
+  // Positions are positions in the concatenation, document() and offset() map them back.
+  // Besides the suffixarray this takes one size_type per element (the previous suffix of the
+  // same document, used for document listing) and one bit per element for the document map.
+  class documentarray {
+  public:
+    typedef suffixarray<std::tokenstring> index_type;
+    typedef index_type::size_type size_type;
+    typedef index_type::interval interval;
+    // The type of the queries and of their elements.
+    typedef std::wordstring value_type;
+    typedef std::string element_type;
+
+    // Builds the index on documents.
+    documentarray(const std::vector<std::wordstring>& documents, sortmethod method = DEEPSHALLOW, unsigned int threads = 1);
+
+    // Returns the number of documents.
+    size_type
+      documents() const { return starts.size(); };
+
+    // Returns the document holding position p.
+    size_type
+      document(size_type p) const { return docstarts.rank(p + 1) - 1; };
+
+    // Returns the position of p within its document.
+    size_type
+      offset(size_type p) const { return p - starts[document(p)]; };
+
+    // Returns the position of the first word of document d.
+    size_type
+      start(size_type d) const { return starts[d]; };
+
+    // Returns the positions of w, as suffixarray::find_all_positions. wildcard is a word.
+    std::vector<size_type>
+      find_all_positions(const std::wordstring& w, const std::string& wildcard = std::string()) const;
+
+    // Returns the number of occurrences of w (its collection frequency).
+    size_type
+      find_all_positions_count(const std::wordstring& w, const std::string& wildcard = std::string()) const;
+
+    // Returns the documents containing w, in increasing order.
+    std::vector<size_type>
+      find_documents(const std::wordstring& w, const std::string& wildcard = std::string()) const;
+
+    // Returns the number of documents containing w.
+    size_type
+      document_frequency(const std::wordstring& w, const std::string& wildcard = std::string()) const;
+
+    // Returns the documents containing w with the number of occurrences in each of them,
+    // in increasing order of document.
+    std::vector< std::pair<size_type,size_type> >
+      term_frequencies(const std::wordstring& w, const std::string& wildcard = std::string()) const;
+
+    // Returns the documents of the suffixes in an interval of getindex(), each one once and
+    // in no particular order. Takes time linear in the number of documents, not in the size
+    // of the interval.
+    std::vector<size_type>
+      find_documents(const interval& in) const;
+
+    // Returns the number of documents of the suffixes in an interval of getindex().
+    size_type
+      document_frequency(const interval& in) const { return find_documents(in).size(); };
+
+    // Returns the vocabulary, to translate ids back to words.
+    const vocabulary&
+      getvocabulary() const { return vocab; };
+
+    // Returns the interned documents with their sentinels.
+    const std::tokenstring&
+      gettokens() const { return tokens; };
+
+    // Returns the suffixarray on the interned documents.
+    const index_type&
+      getindex() const { return sarr; };
+
+  private:
+    // Interns and concatenates the documents, adding the sentinels.
+    static std::tokenstring
+      concatenate(const vocabulary& vocab, const std::vector<std::wordstring>& documents);
+
+    // Returns the intervals of the suffixes starting with the interned query t.
+    // filter is set if matches may run into a sentinel and have to be checked one by one.
+    std::vector<interval>
+      find_intervals(const std::tokenstring& t, bool& filter) const;
+
+    // Returns true if a match of length m at position p stays within its document.
+    bool
+      fits(size_type p, size_type m) const;
+
+    // Not copyable, sarr refers to tokens.
+    documentarray(const documentarray&);
+    documentarray& operator=(const documentarray&);
+
+    // The order matters: sarr is build on tokens, which is build with vocab.
+    vocabulary vocab;
+    std::tokenstring tokens;
+    index_type sarr;
+
+    // The first position of every document.
+    std::vector<size_type> starts;
+    // The first positions of the documents as bits, document() is a rank on this.
+    bitvector docstarts;
+    // prev[i] is 1 + the last suffix before i (in suffixarray order) of the same document, or 0.
+    std::vector<size_type> prev;
+    // Minima of prev.
+    rangemin prevmin;
+  };
+
+	//
+	// rangemin functions:
+	//
+
+	inline
+	void
+	rangemin::build(const std::vector<size_type>& v)
+	{
+		size_type blocks = (v.size() + blocksize - 1) / blocksize;
+		table.clear();
+		if(blocks == 0)
+		{
+			return;
+		}
+		table.push_back(std::vector<size_type>(blocks));
+		for(size_type b = 0; b < blocks; b++)
+		{
+			table[0][b] = scan(v, b * blocksize, std::min(v.size(), (b + 1) * blocksize) - 1);
+		}
+		for(size_type k = 1; ((size_type) 1 << k) <= blocks; k++)
+		{
+			size_type half = (size_type) 1 << (k - 1);
+			table.push_back(std::vector<size_type>(blocks - 2*half + 1));
+			for(size_type b = 0; b < table[k].size(); b++)
+			{
+				size_type x = table[k-1][b];
+				size_type y = table[k-1][b + half];
+				table[k][b] = v[y] < v[x] ? y : x;
+			}
+		}
+	}
+
+	inline
+	rangemin::size_type
+	rangemin::argmin(const std::vector<size_type>& v, size_type l, size_type r) const
+	{
+		size_type lb = l / blocksize + 1;
+		size_type rb = r / blocksize;
+		if(lb >= rb)
+		{ // no whole block in between
+			return scan(v, l, r);
+		}
+		size_type uit = scan(v, l, lb * blocksize - 1);
+		size_type right = scan(v, rb * blocksize, r);
+		if(v[right] < v[uit])
+		{
+			uit = right;
+		}
+		// blocks [lb,rb) as two overlapping powers of two
+		size_type k = 0;
+		while(((size_type) 1 << (k + 1)) <= rb - lb)
+		{
+			k++;
+		}
+		size_type x = table[k][lb];
+		size_type y = table[k][rb - ((size_type) 1 << k)];
+		if(v[x] < v[uit])
+		{
+			uit = x;
+		}
+		if(v[y] < v[uit])
+		{
+			uit = y;
+		}
+		return uit;
+	}
+
+	inline
+	rangemin::size_type
+	rangemin::scan(const std::vector<size_type>& v, size_type l, size_type r)
+	{
+		size_type uit = l;
+		for(size_type i = l + 1; i <= r; i++)
+		{
+			if(v[i] < v[uit])
+			{
+				uit = i;
+			}
+		}
+		return uit;
+	}
+
+	//
+	// documentarray public functions:
+	//
+
+	inline
+	documentarray::documentarray(const std::vector<std::wordstring>& documents, sortmethod method, unsigned int threads):
+		vocab(documents), tokens(concatenate(vocab, documents)), sarr(tokens, method, threads), docstarts(tokens.size())
+	{
+		size_type p = 0;
+		for(size_type d = 0; d < documents.size(); d++)
+		{
+			starts.push_back(p);
+			docstarts.set(p);
+			p += documents[d].size() + 1;
+		}
+		docstarts.buildrank();
+		// Link every suffix to the previous one of the same document.
+		std::vector<size_type> last(documents.size(), 0);
+		prev.resize(sarr.size());
+		for(size_type i = 0; i < sarr.size(); i++)
+		{
+			size_type d = document(sarr.getposition(i));
+			prev[i] = last[d];
+			last[d] = i + 1;
+		}
+		prevmin.build(prev);
+	}
+
+	inline
+	std::vector<documentarray::size_type>
+	documentarray::find_all_positions(const std::wordstring& w, const std::string& wildcard) const
+	{
+		std::vector<size_type> results;
+		bool filter;
+		std::vector<interval> found = find_intervals(vocab.intern(w, wildcard), filter);
+		for(size_type i = 0; i < found.size(); i++)
+		{
+			for(size_type j = found[i].i; j <= found[i].j; j++)
+			{
+				size_type p = sarr.getposition(j);
+				if(!filter || fits(p, w.size()))
+				{
+					results.push_back(p);
+				}
+			}
+		}
+		return results;
+	}
+
+	inline
+	documentarray::size_type
+	documentarray::find_all_positions_count(const std::wordstring& w, const std::string& wildcard) const
+	{
+		bool filter;
+		std::vector<interval> found = find_intervals(vocab.intern(w, wildcard), filter);
+		if(filter)
+		{
+			return find_all_positions(w, wildcard).size();
+		}
+		size_type uit = 0;
+		for(size_type i = 0; i < found.size(); i++)
+		{
+			uit += found[i].size();
+		}
+		return uit;
+	}
+
+	inline
+	std::vector<documentarray::size_type>
+	documentarray::find_documents(const std::wordstring& w, const std::string& wildcard) const
+	{
+		std::vector<size_type> uit;
+		bool filter;
+		std::vector<interval> found = find_intervals(vocab.intern(w, wildcard), filter);
+		if(filter)
+		{
+			std::vector< std::pair<size_type,size_type> > tf = term_frequencies(w, wildcard);
+			for(size_type i = 0; i < tf.size(); i++)
+			{
+				uit.push_back(tf[i].first);
+			}
+			return uit;
+		}
+		for(size_type i = 0; i < found.size(); i++)
+		{
+			std::vector<size_type> docs = find_documents(found[i]);
+			uit.insert(uit.end(), docs.begin(), docs.end());
+		}
+		sort(uit.begin(), uit.end());
+		uit.erase(unique(uit.begin(), uit.end()), uit.end());
+		return uit;
+	}
+
+	inline
+	documentarray::size_type
+	documentarray::document_frequency(const std::wordstring& w, const std::string& wildcard) const
+	{
+		return find_documents(w, wildcard).size();
+	}
+
+	inline
+	std::vector< std::pair<documentarray::size_type,documentarray::size_type> >
+	documentarray::term_frequencies(const std::wordstring& w, const std::string& wildcard) const
+	{
+		std::vector< std::pair<size_type,size_type> > uit;
+		std::vector<size_type> docs = find_all_positions(w, wildcard);
+		for(size_type i = 0; i < docs.size(); i++)
+		{
+			docs[i] = document(docs[i]);
+		}
+		sort(docs.begin(), docs.end());
+		for(size_type i = 0; i < docs.size(); i++)
+		{
+			if(uit.empty() || uit.back().first != docs[i])
+			{
+				uit.push_back(std::pair<size_type,size_type>(docs[i], 0));
+			}
+			uit.back().second++;
+		}
+		return uit;
+	}
+
+	inline
+	std::vector<documentarray::size_type>
+	documentarray::find_documents(const interval& in) const
+	{
+		// Document listing (Muthukrishnan): a suffix is the first of its document within
+		// the interval iff its previous suffix of that document lies before the interval.
+		// The minimum of prev finds such a suffix, if there is one, in every subrange.
+		std::vector<size_type> uit;
+		std::vector<interval> todo;
+		todo.push_back(in);
+		while(!todo.empty())
+		{
+			interval curr = todo.back();
+			todo.pop_back();
+			size_type k = prevmin.argmin(prev, curr.i, curr.j);
+			if(prev[k] > in.i)
+			{ // all documents in this subrange were seen before the interval.
+				continue;
+			}
+			uit.push_back(document(sarr.getposition(k)));
+			if(k > curr.i)
+			{
+				todo.push_back(interval(curr.i, k - 1));
+			}
+			if(k < curr.j)
+			{
+				todo.push_back(interval(k + 1, curr.j));
+			}
+		}
+		return uit;
+	}
+
+	//
+	// documentarray private functions:
+	//
+
+	inline
+	std::tokenstring
+	documentarray::concatenate(const vocabulary& vocab, const std::vector<std::wordstring>& documents)
+	{
+		std::tokenstring uit;
+		for(size_type d = 0; d < documents.size(); d++)
+		{
+			std::tokenstring t = vocab.intern(documents[d]);
+			uit.insert(uit.end(), t.begin(), t.end());
+			// Unique and larger than every word, the last one the largest of all.
+			uit.push_back((vocabulary::id_type) (vocab.size() + 1 + d));
+		}
+		return uit;
+	}
+
+	inline
+	std::vector<documentarray::interval>
+	documentarray::find_intervals(const std::tokenstring& t, bool& filter) const
+	{
+		// Without wildcards a match consists of words only, which never includes a sentinel.
+		vocabulary::id_type wildcard = vocabulary::wildcard;
+		filter = t.empty() || std::find(t.begin(), t.end(), wildcard) != t.end();
+		return sarr.find_intervals(t, wildcard);
+	}
+
+	inline
+	bool
+	documentarray::fits(size_type p, size_type m) const
+	{
+		size_type d = document(p);
+		size_type end = d + 1 < starts.size() ? starts[d + 1] - 1 : tokens.size() - 1;
+		return p + std::max(m, (size_type) 1) <= end;
+	}
+
+}
+#endif // __documents__
+// end of file: documents.h
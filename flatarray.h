@@ -0,0 +1,244 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: flatarray.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the flat array of the suffix array package.
+// A flatarray holds its elements in a vector of its own or uses elements
+// that live elsewhere, for instance in a memory mapped file.
+// It is defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __flatarray__
+#define __flatarray__
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace ns_suffixarray {
+
+  // An array of T that either owns its elements or views elements owned by someone else.
+  // A view is read only, changing its size turns it into an owning copy first.
+  // Copies of a view are views of the same elements.
+  template <class T>
+    class flatarray {
+  public:
+    typedef T value_type;
+    typedef typename std::vector<T>::size_type size_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    // Creates an empty array.
+    flatarray(): ptr(0), len(0), view(false) {};
+
+    // Creates an array of n copies of v.
+    flatarray(size_type n, const T& v = T()): own(n, v), view(false) { refresh(); };
+
+    flatarray(const flatarray& other);
+    flatarray& operator=(const flatarray& other);
+
+    // Views the n elements at p, which must outlive the array (and its copies).
+    void
+      assignview(const T* p, size_type n);
+
+    // Returns true if the elements are not owned by the array.
+    bool
+      isview() const { return view; };
+
+    // Replaces the contents by n copies of v.
+    void
+      assign(size_type n, const T& v);
+
+    // Replaces the contents by [first,last).
+    template <class I>
+      void
+      assign(I first, I last);
+
+    void
+      resize(size_type n, const T& v = T());
+
+    void
+      push_back(const T& v);
+
+    void
+      clear();
+
+    size_type
+      size() const { return len; };
+
+    bool
+      empty() const { return len == 0; };
+
+    T&
+      operator[](size_type i) { return ptr[i]; };
+
+    const T&
+      operator[](size_type i) const { return ptr[i]; };
+
+    // Same as operator[], but throws std::out_of_range if i is not an index.
+    T&
+      at(size_type i) { check(i); return ptr[i]; };
+
+    const T&
+      at(size_type i) const { check(i); return ptr[i]; };
+
+    T&
+      back() { return ptr[len-1]; };
+
+    const T&
+      back() const { return ptr[len-1]; };
+
+    iterator
+      begin() { return ptr; };
+
+    iterator
+      end() { return ptr + len; };
+
+    const_iterator
+      begin() const { return ptr; };
+
+    const_iterator
+      end() const { return ptr + len; };
+
+  private:
+    // Points ptr and len at own.
+    void
+      refresh() { ptr = own.empty() ? 0 : &own[0]; len = own.size(); };
+
+    // Copies viewed elements into own.
+    void
+      makeown();
+
+    void
+      check(size_type i) const { if(i >= len) { throw std::out_of_range("flatarray"); } };
+
+    std::vector<T> own;
+    T* ptr;
+    size_type len;
+    bool view;
+  };
+
+	//
+	// flatarray functions:
+	//
+
+	template <class T>
+	flatarray<T>::flatarray(const flatarray& other): own(other.own), ptr(other.ptr), len(other.len), view(other.view)
+	{
+		if(!view)
+		{
+			refresh();
+		}
+	}
+
+	template <class T>
+	flatarray<T>&
+	flatarray<T>::operator=(const flatarray& other)
+	{
+		if(this != &other)
+		{
+			own = other.own;
+			ptr = other.ptr;
+			len = other.len;
+			view = other.view;
+			if(!view)
+			{
+				refresh();
+			}
+		}
+		return *this;
+	}
+
+	template <class T>
+	void
+	flatarray<T>::assignview(const T* p, size_type n)
+	{
+		std::vector<T>().swap(own);
+		ptr = const_cast<T*>(p);
+		len = n;
+		view = true;
+	}
+
+	template <class T>
+	void
+	flatarray<T>::assign(size_type n, const T& v)
+	{
+		view = false;
+		own.assign(n, v);
+		refresh();
+	}
+
+	template <class T>
+	template <class I>
+	void
+	flatarray<T>::assign(I first, I last)
+	{
+		view = false;
+		own.assign(first, last);
+		refresh();
+	}
+
+	template <class T>
+	void
+	flatarray<T>::resize(size_type n, const T& v)
+	{
+		makeown();
+		own.resize(n, v);
+		refresh();
+	}
+
+	template <class T>
+	void
+	flatarray<T>::push_back(const T& v)
+	{
+		makeown();
+		own.push_back(v);
+		refresh();
+	}
+
+	template <class T>
+	void
+	flatarray<T>::clear()
+	{
+		view = false;
+		own.clear();
+		refresh();
+	}
+
+	template <class T>
+	void
+	flatarray<T>::makeown()
+	{
+		if(view)
+		{
+			own.assign(ptr, ptr + len);
+			view = false;
+			refresh();
+		}
+	}
+
+}
+#endif // __flatarray__
+// end of file: flatarray.h
@@ -0,0 +1,536 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: fmindex.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the compressed index of the suffix array package.
+// The class waveletmatrix stores a sequence of integer codes and counts the
+// occurrences of a code before a position. The class fmindex stores the
+// Burrows-Wheeler transform of a sequence in a waveletmatrix and answers the
+// queries of suffixarray by backward search, without keeping the sequence.
+// Both are defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __fmindex__
+#define __fmindex__
+
+#include <vector>
+#include <algorithm>
+#include "bitvector.h"
+#include "suffixarray.h"
+
+namespace ns_suffixarray {
+
+  // A sequence of codes in [0,sigma] stored in one bitvector per bit of the codes
+  // (a wavelet matrix), taking about log2(sigma+1) bits per code.
+  class waveletmatrix {
+  public:
+    typedef bitvector::size_type size_type;
+
+    // Occurrences of one code in a range, see distinct().
+    class symbolrange
+    {
+    public:
+      size_type code;
+      // The number of occurrences of code before the start and before the end of the range.
+      size_type first;
+      size_type last;
+    };
+
+    waveletmatrix(): n(0) {};
+
+    // Stores codes, which are at most sigma.
+    waveletmatrix(const std::vector<size_type>& codes, size_type sigma);
+
+    // Returns the number of codes.
+    size_type
+      size() const { return n; };
+
+    // Returns the number of occurrences of code c in [0,i).
+    size_type
+      rank(size_type c, size_type i) const;
+
+    // Returns the code at position i and sets r to rank(code, i).
+    size_type
+      inverse(size_type i, size_type& r) const;
+
+    // Appends the codes occurring in [first,last) to out, in increasing order.
+    void
+      distinct(size_type first, size_type last, std::vector<symbolrange>& out) const;
+
+    // Returns the number of bytes used.
+    size_type
+      bytes() const;
+
+  private:
+    void
+      distinct(size_type level, size_type code, size_type first, size_type last, std::vector<symbolrange>& out) const;
+
+    // levels[l] holds bit (levels.size() - 1 - l) of the codes, in the order left by level l-1:
+    // the codes with a 0 bit at level l-1 first, then those with a 1 bit (stable).
+    std::vector<bitvector> levels;
+    // The number of 0 bits of each level.
+    std::vector<size_type> zeros;
+    // Where position 0 ends up after following the bits of each code; rank(c,i) is the
+    // position i ends up at minus starts[c].
+    std::vector<size_type> starts;
+    size_type n;
+  };
+
+  // A compressed index of a sequence, answering the same queries as suffixarray.
+  // It stores the Burrows-Wheeler transform of the sequence in a waveletmatrix and one in
+  // samplerate positions of the suffix array, not the sequence itself. Counting takes
+  // about 2*|w|*log2(sigma) rank operations, locating a match up to samplerate LF-steps.
+  // The samples take about 2*n/samplerate index entries, so samplerate trades the memory
+  // of the index against the time of a locate.
+  // The same rules as for suffixarray apply: the last element of the sequence must be
+  // unique and larger than all other elements, trailing wildcards match past the end.
+  template <class V>
+    class fmindex {
+  public:
+    typedef V value_type;
+    typedef typename value_type::size_type size_type;
+    typedef typename value_type::value_type element_type;
+
+    // Builds the index of s, sorting its suffixes with a suffixarray build with method and
+    // threads (see there). s is not needed afterwards. Every samplerate-th position is sampled,
+    // 1 keeps the whole suffix array.
+    fmindex(const value_type& s, size_type samplerate = 32, sortmethod method = DEEPSHALLOW, unsigned int threads = 1);
+
+    // Returns the position of an occurrence of w, the same one as suffixarray::find_position.
+    // Throws StringNotFound if w does not occur.
+    size_type
+      find_position(const value_type& w, element_type wildcard = element_type()) const;
+
+    // Returns the positions of all occurrences of w, in the order of suffixarray::find_all_positions.
+    std::vector<size_type>
+      find_all_positions(const value_type& w, element_type wildcard = element_type()) const;
+
+    // Returns the number of occurrences of w.
+    size_type
+      find_all_positions_count(const value_type& w, element_type wildcard = element_type()) const;
+
+    // Returns the elements [first,last) of the sequence, walking back from the first
+    // sampled position at or after last.
+    std::vector<element_type>
+      extract(size_type first, size_type last) const;
+
+    // Returns the length of the sequence.
+    size_type
+      size() const { return n; };
+
+    // Returns the sample rate given to the constructor.
+    size_type
+      getsamplerate() const { return rate; };
+
+    // Returns the number of bytes used, besides the distinct elements.
+    size_type
+      bytes() const;
+
+  private:
+    // Rows [first,second) of the (virtual) suffix array.
+    typedef std::pair<size_type,size_type> rows;
+
+    // Returns the rows of the suffixes starting with w, in suffix array order.
+    std::vector<rows>
+      find_rows(const value_type& w, element_type wildcard) const;
+
+    // Returns the code of element e, 0 if it does not occur.
+    size_type
+      code(const element_type& e) const;
+
+    // Returns the position of the suffix in row r.
+    size_type
+      locate(size_type r) const;
+
+    // The distinct elements, sorted. Element alphabet[c-1] has code c, code 0 marks the row
+    // of the suffix starting at 0 in the transform, as it has no preceding element.
+    std::vector<element_type> alphabet;
+    // counts[c] is the number of suffixes starting with a code smaller than c.
+    std::vector<size_type> counts;
+    // Code t[sa[r]-1] for every row r.
+    waveletmatrix bwt;
+    // The rows whose position is a multiple of rate and their positions / rate.
+    bitvector sampled;
+    flatarray<size_type> samples;
+    // inverses[j] is the row of position j*rate.
+    flatarray<size_type> inverses;
+    size_type rate;
+    size_type n;
+  };
+
+	//
+	// waveletmatrix functions:
+	//
+
+	inline
+	waveletmatrix::waveletmatrix(const std::vector<size_type>& codes, size_type sigma): n(codes.size())
+	{
+		size_type bits = 1;
+		while(bits < 64 && (sigma >> bits) != 0)
+		{
+			bits++;
+		}
+		std::vector<size_type> current(codes);
+		std::vector<size_type> ones;
+		for(size_type l = 0; l < bits; l++)
+		{
+			size_type shift = bits - 1 - l;
+			levels.push_back(bitvector(n));
+			ones.clear();
+			size_type z = 0;
+			for(size_type i = 0; i < n; i++)
+			{
+				if((current[i] >> shift) & 1)
+				{
+					levels.back().set(i);
+					ones.push_back(current[i]);
+				}
+				else
+				{
+					current[z++] = current[i];
+				}
+			}
+			std::copy(ones.begin(), ones.end(), current.begin() + z);
+			levels.back().buildrank();
+			zeros.push_back(z);
+		}
+		starts.assign(sigma + 1, 0);
+		for(size_type c = 0; c <= sigma; c++)
+		{
+			size_type p = 0;
+			for(size_type l = 0; l < levels.size(); l++)
+			{
+				size_type r = levels[l].rank(p);
+				p = (c >> (bits - 1 - l)) & 1 ? zeros[l] + r : p - r;
+			}
+			starts[c] = p;
+		}
+	}
+
+	inline
+	waveletmatrix::size_type
+	waveletmatrix::rank(size_type c, size_type i) const
+	{
+		if(c >= starts.size())
+		{
+			return 0;
+		}
+		size_type bits = levels.size();
+		for(size_type l = 0; l < bits; l++)
+		{
+			size_type r = levels[l].rank(i);
+			i = (c >> (bits - 1 - l)) & 1 ? zeros[l] + r : i - r;
+		}
+		return i - starts[c];
+	}
+
+	inline
+	waveletmatrix::size_type
+	waveletmatrix::inverse(size_type i, size_type& r) const
+	{
+		size_type c = 0;
+		for(size_type l = 0; l < levels.size(); l++)
+		{
+			size_type ones = levels[l].rank(i);
+			if(levels[l][i])
+			{
+				c = (c << 1) | 1;
+				i = zeros[l] + ones;
+			}
+			else
+			{
+				c <<= 1;
+				i -= ones;
+			}
+		}
+		r = i - starts[c];
+		return c;
+	}
+
+	inline
+	void
+	waveletmatrix::distinct(size_type first, size_type last, std::vector<symbolrange>& out) const
+	{
+		distinct(0, 0, first, last, out);
+	}
+
+	inline
+	void
+	waveletmatrix::distinct(size_type level, size_type code, size_type first, size_type last, std::vector<symbolrange>& out) const
+	{
+		if(first >= last)
+		{
+			return;
+		}
+		if(level == levels.size())
+		{
+			symbolrange s;
+			s.code = code;
+			s.first = first - starts[code];
+			s.last = last - starts[code];
+			out.push_back(s);
+			return;
+		}
+		size_type rf = levels[level].rank(first);
+		size_type rl = levels[level].rank(last);
+		distinct(level + 1, code << 1, first - rf, last - rl, out);
+		distinct(level + 1, (code << 1) | 1, zeros[level] + rf, zeros[level] + rl, out);
+	}
+
+	inline
+	waveletmatrix::size_type
+	waveletmatrix::bytes() const
+	{
+		size_type uit = starts.size() * sizeof(size_type);
+		for(size_type l = 0; l < levels.size(); l++)
+		{
+			uit += levels[l].getbits().size() * sizeof(uint64_t) + levels[l].getranks().size() * sizeof(size_type);
+		}
+		return uit;
+	}
+
+	//
+	// fmindex functions:
+	//
+
+	template <class V>
+	fmindex<V>::fmindex(const value_type& s, size_type samplerate, sortmethod method, unsigned int threads):
+		rate(samplerate > 0 ? samplerate : 1), n(s.size())
+	{
+		alphabet.assign(s.begin(), s.end());
+		std::sort(alphabet.begin(), alphabet.end());
+		alphabet.erase(std::unique(alphabet.begin(), alphabet.end()), alphabet.end());
+		std::vector<size_type> text(n);
+		counts.assign(alphabet.size() + 2, 0);
+		for(size_type i = 0; i < n; i++)
+		{
+			text[i] = code(s[i]);
+			counts[text[i] + 1]++;
+		}
+		for(size_type c = 1; c < counts.size(); c++)
+		{
+			counts[c] += counts[c-1];
+		}
+		std::vector<size_type> codes(n);
+		sampled = bitvector(n);
+		inverses.resize((n + rate - 1) / rate);
+		{
+			suffixarray<V> sa(s, method, threads);
+			for(size_type r = 0; r < n; r++)
+			{
+				size_type p = sa.getposition(r);
+				codes[r] = p > 0 ? text[p-1] : 0;
+				if(p % rate == 0)
+				{
+					sampled.set(r);
+					samples.push_back(p / rate);
+					inverses[p / rate] = r;
+				}
+			}
+		}
+		sampled.buildrank();
+		bwt = waveletmatrix(codes, alphabet.size());
+	}
+
+	template <class V>
+	typename fmindex<V>::size_type
+	fmindex<V>::code(const element_type& e) const
+	{
+		typename std::vector<element_type>::const_iterator it = std::lower_bound(alphabet.begin(), alphabet.end(), e);
+		if(it == alphabet.end() || *it != e)
+		{
+			return 0;
+		}
+		return (size_type) (it - alphabet.begin()) + 1;
+	}
+
+	template <class V>
+	std::vector<typename fmindex<V>::rows>
+	fmindex<V>::find_rows(const value_type& w, element_type wildcard) const
+	{
+		// Trailing wildcards match anything, also past the end of the sequence.
+		size_type end = w.size();
+		while(end > 0 && w[end-1] == wildcard)
+		{
+			end--;
+		}
+		std::vector<rows> current(1, rows(0, n));
+		std::vector<rows> next;
+		std::vector<waveletmatrix::symbolrange> symbols;
+		for(size_type k = end; k > 0 && !current.empty(); k--)
+		{
+			next.clear();
+			if(w[k-1] == wildcard)
+			{
+				// Any element can precede, except none (the suffix starting at 0).
+				for(size_type i = 0; i < current.size(); i++)
+				{
+					symbols.clear();
+					bwt.distinct(current[i].first, current[i].second, symbols);
+					for(size_type j = 0; j < symbols.size(); j++)
+					{
+						if(symbols[j].code != 0)
+						{
+							size_type base = counts[symbols[j].code];
+							next.push_back(rows(base + symbols[j].first, base + symbols[j].last));
+						}
+					}
+				}
+			}
+			else
+			{
+				size_type c = code(w[k-1]);
+				if(c != 0 && k == end)
+				{
+					// All suffixes starting with c. The last element of the sequence does
+					// not occur in the transform, so this is not rank(c, n).
+					next.push_back(rows(counts[c], counts[c+1]));
+				}
+				for(size_type i = 0; c != 0 && k != end && i < current.size(); i++)
+				{
+					size_type first = counts[c] + bwt.rank(c, current[i].first);
+					size_type last = counts[c] + bwt.rank(c, current[i].second);
+					if(first < last)
+					{
+						next.push_back(rows(first, last));
+					}
+				}
+			}
+			current.swap(next);
+		}
+		std::sort(current.begin(), current.end());
+		return current;
+	}
+
+	template <class V>
+	typename fmindex<V>::size_type
+	fmindex<V>::locate(size_type r) const
+	{
+		// Walks back through the sequence (LF-mapping) to a sampled position.
+		size_type steps = 0;
+		while(!sampled[r])
+		{
+			size_type rank;
+			size_type c = bwt.inverse(r, rank);
+			r = counts[c] + rank;
+			steps++;
+		}
+		return samples[sampled.rank(r)] * rate + steps;
+	}
+
+	template <class V>
+	std::vector<typename fmindex<V>::element_type>
+	fmindex<V>::extract(size_type first, size_type last) const
+	{
+		last = std::min(last, n);
+		if(first >= last)
+		{
+			return std::vector<element_type>();
+		}
+		std::vector<element_type> uit(last - first);
+		// Start at the row of a sampled position p >= last, or of the last element, which is
+		// the largest and so in the last row.
+		size_type p = (last + rate - 1) / rate * rate;
+		size_type r;
+		if(p < n)
+		{
+			r = inverses[p / rate];
+		}
+		else
+		{
+			p = n - 1;
+			r = n - 1;
+			if(p < last)
+			{
+				uit[p - first] = alphabet.back();
+			}
+		}
+		// The transform holds the element before the suffix of each row.
+		while(p > first)
+		{
+			size_type rank;
+			size_type c = bwt.inverse(r, rank);
+			p--;
+			if(p < last)
+			{
+				uit[p - first] = alphabet[c - 1];
+			}
+			r = counts[c] + rank;
+		}
+		return uit;
+	}
+
+	template <class V>
+	typename fmindex<V>::size_type
+	fmindex<V>::find_position(const value_type& w, element_type wildcard) const
+	{
+		std::vector<rows> found = find_rows(w, wildcard);
+		if(found.size() > 0)
+		{
+			return locate(found[0].first);
+		}
+		throw StringNotFound();
+	}
+
+	template <class V>
+	std::vector<typename fmindex<V>::size_type>
+	fmindex<V>::find_all_positions(const value_type& w, element_type wildcard) const
+	{
+		std::vector<size_type> results;
+		std::vector<rows> found = find_rows(w, wildcard);
+		for(size_type i = 0; i < found.size(); i++)
+		{
+			for(size_type r = found[i].first; r < found[i].second; r++)
+			{
+				results.push_back(locate(r));
+			}
+		}
+		return results;
+	}
+
+	template <class V>
+	typename fmindex<V>::size_type
+	fmindex<V>::find_all_positions_count(const value_type& w, element_type wildcard) const
+	{
+		std::vector<rows> found = find_rows(w, wildcard);
+		size_type uit = 0;
+		for(size_type i = 0; i < found.size(); i++)
+		{
+			uit += found[i].second - found[i].first;
+		}
+		return uit;
+	}
+
+	template <class V>
+	typename fmindex<V>::size_type
+	fmindex<V>::bytes() const
+	{
+		return bwt.bytes() + counts.size() * sizeof(size_type) + sampled.getbits().size() * sizeof(uint64_t)
+			+ sampled.getranks().size() * sizeof(size_type) + (samples.size() + inverses.size()) * sizeof(size_type);
+	}
+
+}
+#endif // __fmindex__
+// end of file: fmindex.h
@@ -35,6 +35,10 @@
 #include "wordstring.h"
 #include <vector>
 #include "suffixarray.h"
+#include "vocabulary.h"
+#include "documents.h"
+#include "numa.h"
+#include "querycache.h"
 #include <fstream>
 #include <cstdlib>
 #include <limits>
@@ -74,6 +78,16 @@ cannot implement long option handling
 static struct option long_options[] = {
   {"help", no_argument, 0, 'h'},
   {"file", required_argument, 0, 'f'},
+  {"induced", no_argument, 0, 'i'},
+  {"threads", required_argument, 0, 't'},
+  {"documents", no_argument, 0, 'd'},
+  {"stats", required_argument, 0, 'j'},
+  {"save", required_argument, 0, 'o'},
+  {"load", required_argument, 0, 'l'},
+  {"numa", required_argument, 0, 'n'},
+  {"querythreads", required_argument, 0, 'q'},
+  {"cache", required_argument, 0, 'c'},
+  {"prewarm", required_argument, 0, 'w'},
   {0, 0, 0, 0}
 };
 
@@ -86,6 +100,51 @@ typedef suffixarray<string> sasa;
 
 string program_name;
 
+// The queries [first,last) of a batch.
+class queryjob {
+public:
+  queryjob(): first(0), last(0) {};
+  queryjob(size_t f, size_t l): first(f), last(l) {};
+  size_t first;
+  size_t last;
+};
+
+// Answers the query jobs of a batch of lines on the workers of a workstealingpool.
+// With a numareplicas every worker but the main thread (worker 0) is pinned to a node on its
+// first job and queries the replica of that node, the main thread queries the replica of the
+// node it runs on. With a querycache the cache is asked first, a miss queries the worker's index.
+class queryanswerer {
+public:
+  queryanswerer(const vector<string>& l, vector<internedsuffixarray::size_type>& r, const internedsuffixarray& t, numareplicas<internedsuffixarray>* p, const querycache<internedsuffixarray>* c, unsigned int workers):
+    lines(l), results(r), tree(t), placed(p), cache(c), indexes(workers, (const internedsuffixarray*) 0) {};
+
+  void operator()(const queryjob& job, unsigned int w) {
+    // The threads of the pool stay the same, so each one is pinned once.
+    const internedsuffixarray* index = indexes[w];
+    if (!index && placed && w == 0) {
+      index = &placed->local();
+    } else if (!index) {
+      index = placed ? &placed->pin(w) : &tree;
+      indexes[w] = index;
+    }
+    for (size_t i = job.first; i < job.last; i++) {
+      wordstring totest;
+      istringstream a (lines[i], istringstream::in);
+      a >> totest;
+      results[i] = cache ? cache->find_all_positions_count(*index, totest) : index->find_all_positions_count(totest);
+    }
+  }
+
+private:
+  const vector<string>& lines;
+  vector<internedsuffixarray::size_type>& results;
+  const internedsuffixarray& tree;
+  numareplicas<internedsuffixarray>* placed;
+  const querycache<internedsuffixarray>* cache;
+  // The index of every worker, set by its first job (only written by that worker).
+  vector<const internedsuffixarray*> indexes;
+};
+
 void usage() {
   cerr << "Usage: " << program_name << "[OPTION]..." << endl;
   cerr << "This program reads in a corpus and stores it in a ";
@@ -95,6 +154,26 @@ void usage() {
   cerr << "Show this help and exit" << endl;
   cerr << "  -f, --file FILE   ";
   cerr << "Filename of the corpus to be read" << endl;
+  cerr << "  -i, --induced     ";
+  cerr << "Build the suffixarray with linear-time induced sorting" << endl;
+  cerr << "  -t, --threads N   ";
+  cerr << "Number of threads used to build the suffixarray" << endl;
+  cerr << "  -d, --documents   ";
+  cerr << "Every line of the corpus is a document, also return the number of documents" << endl;
+  cerr << "  -j, --stats FILE  ";
+  cerr << "Write build and query statistics as JSON to FILE when done" << endl;
+  cerr << "  -o, --save FILE   ";
+  cerr << "Store the corpus, its vocabulary and the suffixarray in FILE" << endl;
+  cerr << "  -l, --load FILE   ";
+  cerr << "Load an index stored with --save instead of reading a corpus" << endl;
+  cerr << "  -n, --numa MODE   ";
+  cerr << "Place a loaded index interleaved over the NUMA nodes or replicated per node (interleave, replicate)" << endl;
+  cerr << "  -q, --querythreads N ";
+  cerr << "Answer the queries on N threads, the answers keep the order of the queries" << endl;
+  cerr << "  -c, --cache N     ";
+  cerr << "Cache the answers of up to N frequent queries" << endl;
+  cerr << "  -w, --prewarm FILE ";
+  cerr << "Fill the cache with the queries in FILE (one per line) before reading queries" << endl;
   cerr << "  -s, --server PORT ";
   cerr << "Turn server mode on, listening on the port" << endl;
   exit(0);
@@ -103,13 +182,25 @@ void usage() {
 int
 main(int argc, char* argv[]) {
   program_name = argv[0];
+  // Before any input or output, afterwards its effect is implementation defined.
+  ios::sync_with_stdio(false);
 
   ifstream is;
+  sortmethod method = DEEPSHALLOW;
+  unsigned int threads = 1;
+  bool documents = false;
+  string statsfile;
+  string savefile;
+  string loadfile;
+  numaplacement placement = NUMASHARED;
+  unsigned int querythreads = 1;
+  size_t cachesize = 0;
+  string prewarmfile;
 
   // Handle arguments
   int opt;
   int option_index;
-  const char* optstring="hf:s:";
+  const char* optstring="hf:it:dj:o:l:n:q:c:w:s:";
   while ((opt = getopt_long_only(argc, argv, optstring, long_options,
           &option_index)) !=-1){
     switch (opt) {
@@ -123,35 +214,180 @@ main(int argc, char* argv[]) {
           exit (-1);
         }
         break;
+      case 'i':
+        method = INDUCEDSORTING;
+        break;
+      case 't':
+        threads = atoi(optarg);
+        break;
+      case 'd':
+        documents = true;
+        break;
+      case 'j':
+        statsfile = optarg;
+        break;
+      case 'o':
+        savefile = optarg;
+        break;
+      case 'l':
+        loadfile = optarg;
+        break;
+      case 'n':
+        if (string(optarg) == "interleave") {
+          placement = NUMAINTERLEAVE;
+        } else if (string(optarg) == "replicate") {
+          placement = NUMAREPLICATE;
+        } else {
+          cerr << "unknown numa mode " << optarg << endl;
+          exit (-1);
+        }
+        break;
+      case 'q':
+        querythreads = atoi(optarg);
+        break;
+      case 'c':
+        cachesize = atol(optarg);
+        break;
+      case 'w':
+        prewarmfile = optarg;
+        break;
       default:
         cerr << "unknown argument " << opt << endl;
         exit (-1);
     }
   }
-  if (!is.is_open()) {
+  if (documents && (!savefile.empty() || !loadfile.empty() || placement != NUMASHARED || querythreads > 1 || cachesize > 0 || !prewarmfile.empty())) {
+    cerr << "--documents cannot be combined with --save, --load, --numa, --querythreads, --cache or --prewarm" << endl;
+    exit (-1);
+  }
+  if (!is.is_open() && loadfile.empty()) {
     cerr << "input file is not open" << endl;
     exit (-1);
   }
 
-
-	wordstring word;
-	is >> word;
-	//word.push_back(numeric_limits<int>::max());
-	word.push_back("~~~~~~~~~~~~~");
-	sa_string tree(word);
+  char input[1000000];
+  if (documents) {
+	vector<wordstring> docs;
+	string line;
+	while (getline(is, line)) {
+		docs.push_back(wordstring());
+		istringstream a (line, istringstream::in);
+		string w;
+		while (a >> w) {
+			docs.back().push_back(w);
+		}
+	}
 	is.close();
+	documentarray index(docs, method, threads);
+	vector<wordstring>().swap(docs);
+	if (!statsfile.empty()) {
+		index.getindex().countqueries(true);
+	}
+    cerr << "STREE: SUFFIXARRAY Ready!" << endl;
+    while ( cin.getline(input, 1000000) ) {
+	wordstring totest;
+      istringstream a (string(input), istringstream::in);
+      a >> totest;
+      cout << index.find_all_positions_count(totest) << "\t" << index.document_frequency(totest) << endl;
+    }
+    if (!statsfile.empty()) {
+      index.getindex().getstats().savejson(statsfile);
+    }
+    return 0;
+  }
+
+	internedsuffixarray* loaded = 0;
+	numareplicas<internedsuffixarray>* placed = 0;
+	if (!loadfile.empty() && placement != NUMASHARED) {
+		placed = new numareplicas<internedsuffixarray>(loadfile, placement);
+		loaded = &placed->replica(0);
+		if (loaded->size() == 0) {
+			cerr << "cannot load index " << loadfile << endl;
+			exit (-1);
+		}
+	} else if (!loadfile.empty()) {
+		loaded = new internedsuffixarray(loadfile);
+		if (loaded->size() == 0) {
+			cerr << "cannot load index " << loadfile << endl;
+			exit (-1);
+		}
+	} else {
+		wordstring word;
+		is >> word;
+		//word.push_back(numeric_limits<int>::max());
+		word.push_back("~~~~~~~~~~~~~");
+		// Build on token ids, the words themselves are not needed afterwards.
+		loaded = new internedsuffixarray(word, method, threads);
+		is.close();
+	}
+	internedsuffixarray& tree = *loaded;
+	if (!statsfile.empty()) {
+		tree.getindex().countqueries(true);
+	}
+	if (!savefile.empty() && !tree.saveindex(savefile)) {
+		cerr << "cannot store index " << savefile << endl;
+	}
+	
+	querycache<internedsuffixarray>* cache = 0;
+	if (cachesize > 0) {
+		cache = new querycache<internedsuffixarray>(tree, cachesize);
+		if (!prewarmfile.empty()) {
+			cache->prewarm(prewarmfile);
+		}
+	}
 	
-  sa_string::size_type result;
+  internedsuffixarray::size_type result;
+	// The single-threaded loop queries the replica of the node the main thread runs on.
+	const internedsuffixarray& index = placed ? placed->local() : tree;
     cerr << "STREE: SUFFIXARRAY Ready!" << endl;
-    char input[1000000];
-    while ( cin.getline(input, 1000000) ) {  // read the string and write it back
+    if (querythreads > 1) {
+      // Reads the queries that are already available (at most a batch), answers them in
+      // parallel and prints the answers in order, so interactive use still gets every
+      // answer right away. The threads of the pool live as long as the loop.
+      const size_t batch = 16384;
+      const size_t chunk = 64;
+      workstealingpool<queryjob> pool(querythreads);
+      vector<string> lines;
+      vector<internedsuffixarray::size_type> results;
+      queryanswerer answerer(lines, results, tree, placed, cache, pool.size());
+      string line;
+      while (getline(cin, line)) {
+        lines.clear();
+        lines.push_back(line);
+        while (lines.size() < batch && cin.rdbuf()->in_avail() > 0 && getline(cin, line)) {
+          lines.push_back(line);
+        }
+        results.assign(lines.size(), 0);
+        for (size_t i = 0; i < lines.size(); i += chunk) {
+          pool.push(i / chunk, queryjob(i, min(i + chunk, lines.size())));
+        }
+        pool.run(answerer);
+        for (size_t i = 0; i < results.size(); i++) {
+          cout << results[i] << '\n';
+        }
+        cout.flush();
+      }
+    }
+    while ( querythreads <= 1 && cin.getline(input, 1000000) ) {  // read the string and write it back
       //cerr << "STree: RECIEVED ***" << input << "***"<< endl;
 	wordstring totest;
       istringstream a (string(input), istringstream::in);
       a >> totest;
-      result = tree.find_all_positions_count(totest);
+      result = cache ? cache->find_all_positions_count(index, totest) : index.find_all_positions_count(totest);
       //cerr << "SARRAY: Sending result: ***"<<result <<"***"<< endl;
       cout << result << endl;
     }
+    if (!statsfile.empty()) {
+      tree.getindex().getstats().savejson(statsfile);
+    }
+    if (cache) {
+      cerr << "STREE: cache hits " << cache->gethits() << " misses " << cache->getmisses() << endl;
+      delete cache;
+    }
+    if (placed) {
+      delete placed;
+    } else {
+      delete loaded;
+    }
 }
 // end of file: main.cpp
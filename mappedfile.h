@@ -0,0 +1,459 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: mappedfile.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the binary file support of the suffix array package.
+// The class mappedfile maps a file read only into memory. The classes
+// sectionwriter and sectionreader write and read a binary block made of a
+// header and a number of flat, aligned sections, which can be used in place
+// once the file is mapped.
+// Everything is defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __mappedfile__
+#define __mappedfile__
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "flatarray.h"
+
+namespace ns_suffixarray {
+
+  // A file mapped read only into memory.
+  // Copies share the mapping, it is removed when the last copy is destroyed.
+  class mappedfile {
+  public:
+    typedef size_t size_type;
+
+    // Creates an empty mapping.
+    mappedfile(): shared(0) {};
+
+    // Maps file f. On failure a message is written to std::cerr and good() returns false.
+    mappedfile(const std::string& f);
+
+    // Takes over length bytes at addr, mapped with mmap, which are unmapped with the last copy.
+    mappedfile(void* addr, size_type length);
+
+    mappedfile(const mappedfile& other);
+    mappedfile& operator=(const mappedfile& other);
+    ~mappedfile() { release(); };
+
+    // Returns true if a file is mapped.
+    bool
+      good() const { return shared != 0; };
+
+    // Returns the first byte of the file.
+    const char*
+      data() const { return shared ? (const char*) shared->addr : 0; };
+
+    // Returns the size of the file.
+    size_type
+      size() const { return shared ? shared->length : 0; };
+
+  private:
+    // The mapping and the number of mappedfiles using it.
+    class mapping
+    {
+    public:
+      void* addr;
+      size_type length;
+      volatile long refs;
+    };
+
+    void
+      release();
+
+    mapping* shared;
+  };
+
+  // Writes a block of sections: a header followed by the sections, every section starting at a
+  // multiple of sectionalign bytes from the start of the block.
+  // The header holds an 8 byte magic, the version, a byte order mark, the size of the
+  // size_type used, a count that the reader can check and the offset and length of each section.
+  class sectionwriter {
+  public:
+    typedef uint64_t offset_type;
+
+    // Alignment of the sections, a cache line.
+    static const offset_type sectionalign = 64;
+
+    // Starts a block with the given magic (8 characters), version, size of size_type and count.
+    sectionwriter(const char* magic, uint32_t version, uint32_t wordsize, offset_type count);
+
+    // Adds a section, the elements must stay unchanged until write() is done.
+    template <class T>
+      void
+      add(const flatarray<T>& a) { add(a.begin(), a.size() * sizeof(T)); }
+
+    // Adds a section of bytes. If p is 0 write() leaves the section out and the caller
+    // writes its bytes right after the block, which only works for the last section.
+    void
+      add(const void* p, offset_type bytes);
+
+    // Adds a section of bytes that write() copies from is, for sections too large to keep in
+    // memory. is must be positioned at their start and stay open until write() is done.
+    void
+      add(std::istream& is, offset_type bytes);
+
+    // Returns the number of bytes write() writes.
+    offset_type
+      size() const;
+
+    // Writes the block on os, returns false on failure.
+    bool
+      write(std::ostream& os) const;
+
+  private:
+    // Returns the size of the header.
+    offset_type
+      headersize() const;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t wordsize;
+    offset_type count;
+    std::vector<const char*> sections;
+    std::vector<std::istream*> streams;
+    std::vector<offset_type> lengths;
+  };
+
+  // Reads a block written by a sectionwriter from memory, without copying.
+  class sectionreader {
+  public:
+    typedef sectionwriter::offset_type offset_type;
+
+    // Creates a reader of nothing, good() returns false.
+    sectionreader(): base(0), available(0), count(0), number(0), ok(false) {};
+
+    // Checks the header of the block at p (of at most available bytes) against the
+    // magic, version and size of size_type. On failure a message is written to std::cerr
+    // and good() returns false.
+    sectionreader(const char* p, offset_type available, const char* magic, uint32_t version, uint32_t wordsize);
+
+    bool
+      good() const { return ok; };
+
+    // Returns the count given to the writer.
+    offset_type
+      getcount() const { return count; };
+
+    // Returns the number of sections.
+    offset_type
+      sections() const { return number; };
+
+    // Returns the number of bytes of the block.
+    offset_type
+      size() const;
+
+    // Views section i in a, returns false if the section does not hold whole elements.
+    template <class T>
+      bool
+      view(offset_type i, flatarray<T>& a) const;
+
+    // Returns the first byte of section i and its length.
+    const char*
+      section(offset_type i, offset_type& bytes) const;
+
+  private:
+    // Reads the offset_type at byte b of the header.
+    offset_type
+      field(offset_type b) const { offset_type v; memcpy(&v, base + b, sizeof(v)); return v; };
+
+    const char* base;
+    offset_type available;
+    offset_type count;
+    offset_type number;
+    bool ok;
+  };
+
+	//
+	// mappedfile functions:
+	//
+
+	inline
+	mappedfile::mappedfile(const std::string& f): shared(0)
+	{
+		int fd = open(f.c_str(), O_RDONLY);
+		if(fd < 0)
+		{
+			std::cerr << "Unable to open file " << f << std::endl;
+			return;
+		}
+		struct stat st;
+		if(fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			std::cerr << "Unable to map empty file " << f << std::endl;
+			close(fd);
+			return;
+		}
+		void* addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if(addr == MAP_FAILED)
+		{
+			std::cerr << "Unable to map file " << f << std::endl;
+			return;
+		}
+		shared = new mapping();
+		shared->addr = addr;
+		shared->length = st.st_size;
+		shared->refs = 1;
+	}
+
+	inline
+	mappedfile::mappedfile(void* addr, size_type length): shared(new mapping())
+	{
+		shared->addr = addr;
+		shared->length = length;
+		shared->refs = 1;
+	}
+
+	inline
+	mappedfile::mappedfile(const mappedfile& other): shared(other.shared)
+	{
+		if(shared)
+		{
+			__sync_fetch_and_add(&shared->refs, 1);
+		}
+	}
+
+	inline
+	mappedfile&
+	mappedfile::operator=(const mappedfile& other)
+	{
+		if(shared != other.shared)
+		{
+			release();
+			shared = other.shared;
+			if(shared)
+			{
+				__sync_fetch_and_add(&shared->refs, 1);
+			}
+		}
+		return *this;
+	}
+
+	inline
+	void
+	mappedfile::release()
+	{
+		if(shared && __sync_sub_and_fetch(&shared->refs, 1) == 0)
+		{
+			munmap(shared->addr, shared->length);
+			delete shared;
+		}
+		shared = 0;
+	}
+
+	//
+	// sectionwriter functions:
+	//
+
+	inline
+	sectionwriter::sectionwriter(const char* m, uint32_t v, uint32_t w, offset_type c): version(v), wordsize(w), count(c)
+	{
+		memcpy(magic, m, 8);
+	}
+
+	inline
+	void
+	sectionwriter::add(const void* p, offset_type bytes)
+	{
+		sections.push_back((const char*) p);
+		streams.push_back(0);
+		lengths.push_back(bytes);
+	}
+
+	inline
+	void
+	sectionwriter::add(std::istream& is, offset_type bytes)
+	{
+		sections.push_back(0);
+		streams.push_back(&is);
+		lengths.push_back(bytes);
+	}
+
+	inline
+	sectionwriter::offset_type
+	sectionwriter::headersize() const
+	{
+		// magic, version, byte order, word size, number of sections, count, then offset and length per section
+		return 8 + 4 * 4 + 8 + 16 * sections.size();
+	}
+
+	inline
+	sectionwriter::offset_type
+	sectionwriter::size() const
+	{
+		offset_type uit = headersize();
+		for(size_t i = 0; i < sections.size(); i++)
+		{
+			uit = (uit + sectionalign - 1) / sectionalign * sectionalign + lengths[i];
+		}
+		return uit;
+	}
+
+	inline
+	bool
+	sectionwriter::write(std::ostream& os) const
+	{
+		std::vector<offset_type> offsets;
+		offset_type pos = headersize();
+		for(size_t i = 0; i < sections.size(); i++)
+		{
+			pos = (pos + sectionalign - 1) / sectionalign * sectionalign;
+			offsets.push_back(pos);
+			pos += lengths[i];
+		}
+		uint32_t order = 0x01020304;
+		uint32_t number = (uint32_t) sections.size();
+		os.write(magic, 8);
+		os.write((const char*) &version, 4);
+		os.write((const char*) &order, 4);
+		os.write((const char*) &wordsize, 4);
+		os.write((const char*) &number, 4);
+		os.write((const char*) &count, 8);
+		for(size_t i = 0; i < sections.size(); i++)
+		{
+			os.write((const char*) &offsets[i], 8);
+			os.write((const char*) &lengths[i], 8);
+		}
+		pos = headersize();
+		const char zeros[sectionalign] = {0};
+		for(size_t i = 0; i < sections.size(); i++)
+		{
+			os.write(zeros, offsets[i] - pos);
+			if(sections[i])
+			{
+				os.write(sections[i], lengths[i]);
+			}
+			else if(streams[i])
+			{
+				std::vector<char> buf(1 << 16);
+				offset_type done = 0;
+				while(done < lengths[i])
+				{
+					streams[i]->read(&buf[0], std::min((offset_type) buf.size(), lengths[i] - done));
+					offset_type got = streams[i]->gcount();
+					if(got == 0)
+					{
+						std::cerr << "Section ends before its length" << std::endl;
+						return false;
+					}
+					os.write(&buf[0], got);
+					done += got;
+				}
+			}
+			pos = offsets[i] + lengths[i];
+		}
+		return os.good();
+	}
+
+	//
+	// sectionreader functions:
+	//
+
+	inline
+	sectionreader::sectionreader(const char* p, offset_type a, const char* magic, uint32_t version, uint32_t wordsize):
+		base(p), available(a), count(0), number(0), ok(false)
+	{
+		if(p == 0 || available < 32 || memcmp(p, magic, 8) != 0)
+		{
+			std::cerr << "Not a binary index" << std::endl;
+			return;
+		}
+		uint32_t fields[4];
+		memcpy(fields, p + 8, sizeof(fields));
+		if(fields[0] != version || fields[1] != 0x01020304 || fields[2] != wordsize)
+		{
+			std::cerr << "Binary index of version " << fields[0] << " or from another platform" << std::endl;
+			return;
+		}
+		number = fields[3];
+		count = field(24);
+		if(available < 32 + 16 * number)
+		{
+			std::cerr << "Binary index is truncated" << std::endl;
+			return;
+		}
+		for(offset_type i = 0; i < number; i++)
+		{
+			if(field(32 + 16*i) + field(40 + 16*i) > available)
+			{
+				std::cerr << "Binary index is truncated" << std::endl;
+				return;
+			}
+		}
+		ok = true;
+	}
+
+	inline
+	sectionreader::offset_type
+	sectionreader::size() const
+	{
+		offset_type uit = 32 + 16 * number;
+		for(offset_type i = 0; i < number; i++)
+		{
+			uit = std::max(uit, field(32 + 16*i) + field(40 + 16*i));
+		}
+		return uit;
+	}
+
+	inline
+	const char*
+	sectionreader::section(offset_type i, offset_type& bytes) const
+	{
+		bytes = field(40 + 16*i);
+		return base + field(32 + 16*i);
+	}
+
+	template <class T>
+	bool
+	sectionreader::view(offset_type i, flatarray<T>& a) const
+	{
+		if(i >= number)
+		{
+			return false;
+		}
+		offset_type bytes;
+		const char* p = section(i, bytes);
+		if(bytes % sizeof(T) != 0)
+		{
+			return false;
+		}
+		a.assignview((const T*) p, bytes / sizeof(T));
+		return true;
+	}
+
+}
+#endif // __mappedfile__
+// end of file: mappedfile.h
@@ -0,0 +1,391 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: numa.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the NUMA support of the suffix array package.
+// The class numatopology reads the nodes and cpus of the machine (Linux),
+// pins threads to a node and places copies of a mapped index in memory.
+// The class numareplicas loads an index file either interleaved over all
+// nodes or as one replica per node, for query servers with several sockets.
+// Both are defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __numa__
+#define __numa__
+
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "mappedfile.h"
+
+namespace ns_suffixarray {
+
+  // How numareplicas places an index:
+  // NUMASHARED uses the mapped file as is, the pages land where the kernel reads them,
+  // NUMAINTERLEAVE copies it once with its pages spread round robin over the nodes,
+  // NUMAREPLICATE copies it once per node, each copy in the memory of its node.
+  enum numaplacement { NUMASHARED, NUMAINTERLEAVE, NUMAREPLICATE };
+
+  // The NUMA nodes of the machine and their cpus, read from /sys/devices/system/node.
+  // Without that information (or NUMA support in the kernel) there is one node with
+  // all cpus and the memory policies do nothing.
+  class numatopology {
+  public:
+    typedef std::vector<int>::size_type size_type;
+
+    numatopology();
+
+    // Returns the number of nodes (at least 1).
+    size_type
+      nodes() const { return cpus.size(); };
+
+    // Returns the cpus of node i.
+    const std::vector<int>&
+      getcpus(size_type i) const { return cpus[i]; };
+
+    // Returns the node the calling thread runs on.
+    size_type
+      current() const;
+
+    // Pins the calling thread to the cpus of node i, returns false on failure.
+    bool
+      pin(size_type i) const;
+
+    // Sets the memory policy of the calling thread for the memory it touches first:
+    // interleaved over all nodes, or preferably on node i. reset() restores the default.
+    void
+      interleave() const;
+
+    void
+      prefer(size_type i) const;
+
+    void
+      reset() const;
+
+    // Returns a private, read only copy of m in anonymous memory, whose pages follow the
+    // memory policy of the calling thread. Transparent huge pages are requested for it.
+    // On failure a message is written to std::cerr and m itself is returned.
+    mappedfile
+      copy(const mappedfile& m) const;
+
+  private:
+    // Parses a sysfs list like "0-3,8-11".
+    static std::vector<int>
+      parselist(const std::string& l);
+
+    // Calls set_mempolicy with the nodes in mask.
+    void
+      setpolicy(int mode, const std::vector<size_type>& mask) const;
+
+    // The cpus per node and the node id per node (ids may have gaps).
+    std::vector< std::vector<int> > cpus;
+    std::vector<int> ids;
+    // The node of every cpu, -1 if unknown.
+    std::vector<int> nodeofcpu;
+    bool numa;
+  };
+
+  // An index of type S placed on the NUMA nodes of the machine.
+  // S is constructed from a mappedfile of an index file, for instance an internedsuffixarray.
+  // Worker w of a query pool calls pin(w) once, when its thread starts, which pins it to a
+  // node and returns the replica of that node, so all its queries read memory of its socket.
+  template <class S>
+    class numareplicas {
+  public:
+    typedef numatopology::size_type size_type;
+
+    // Loads index file f with the given placement. With NUMAREPLICATE every replica is
+    // build by the calling thread while pinned to its node, so the memory S allocates
+    // itself is local as well.
+    numareplicas(const std::string& f, numaplacement how);
+    ~numareplicas();
+
+    // Returns the number of replicas.
+    size_type
+      size() const { return replicas.size(); };
+
+    // Returns the replica of node i (the only one unless NUMAREPLICATE), without pinning.
+    S&
+      replica(size_type i) { return *replicas[replicas.size() > 1 ? i % replicas.size() : 0]; };
+
+    // Returns the replica of the node the calling thread runs on.
+    S&
+      local() { return *replicas[replicas.size() > 1 ? topology.current() : 0]; };
+
+    // Pins the calling thread to node w modulo the number of nodes and returns its replica.
+    // This is a system call, pin a thread once and keep the reference.
+    S&
+      pin(unsigned int w);
+
+    const numatopology&
+      gettopology() const { return topology; };
+
+  private:
+    // Not copyable.
+    numareplicas(const numareplicas&);
+    numareplicas& operator=(const numareplicas&);
+
+    numatopology topology;
+    std::vector<S*> replicas;
+  };
+
+	//
+	// numatopology functions:
+	//
+
+	inline
+	numatopology::numatopology(): numa(false)
+	{
+		std::ifstream online("/sys/devices/system/node/online");
+		std::string line;
+		if(online && std::getline(online, line))
+		{
+			std::vector<int> nodes = parselist(line);
+			for(size_type i = 0; i < nodes.size(); i++)
+			{
+				std::ostringstream name;
+				name << "/sys/devices/system/node/node" << nodes[i] << "/cpulist";
+				std::ifstream cpulist(name.str().c_str());
+				std::string l;
+				if(cpulist && std::getline(cpulist, l) && !parselist(l).empty())
+				{
+					cpus.push_back(parselist(l));
+					ids.push_back(nodes[i]);
+				}
+			}
+		}
+		if(cpus.empty())
+		{
+			long n = sysconf(_SC_NPROCESSORS_ONLN);
+			cpus.push_back(std::vector<int>());
+			ids.push_back(0);
+			for(long c = 0; c < n; c++)
+			{
+				cpus[0].push_back((int) c);
+			}
+		}
+		else
+		{
+			// set_mempolicy fails with ENOSYS on kernels without NUMA support.
+			numa = cpus.size() > 1 && syscall(SYS_get_mempolicy, 0, 0, 0, 0, 0) == 0;
+		}
+		for(size_type i = 0; i < cpus.size(); i++)
+		{
+			for(size_type j = 0; j < cpus[i].size(); j++)
+			{
+				if((size_type) cpus[i][j] >= nodeofcpu.size())
+				{
+					nodeofcpu.resize(cpus[i][j] + 1, -1);
+				}
+				nodeofcpu[cpus[i][j]] = (int) i;
+			}
+		}
+	}
+
+	inline
+	std::vector<int>
+	numatopology::parselist(const std::string& l)
+	{
+		std::vector<int> uit;
+		std::istringstream is(l);
+		std::string range;
+		while(std::getline(is, range, ','))
+		{
+			std::string::size_type dash = range.find('-');
+			int first = atoi(range.c_str());
+			int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+			for(int i = first; i <= last && !range.empty(); i++)
+			{
+				uit.push_back(i);
+			}
+		}
+		return uit;
+	}
+
+	inline
+	numatopology::size_type
+	numatopology::current() const
+	{
+		int c = sched_getcpu();
+		if(c < 0 || (size_type) c >= nodeofcpu.size() || nodeofcpu[c] < 0)
+		{
+			return 0;
+		}
+		return nodeofcpu[c];
+	}
+
+	inline
+	bool
+	numatopology::pin(size_type i) const
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for(size_type j = 0; j < cpus[i].size(); j++)
+		{
+			CPU_SET(cpus[i][j], &set);
+		}
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+	}
+
+	inline
+	void
+	numatopology::setpolicy(int mode, const std::vector<size_type>& nodes) const
+	{
+		if(!numa)
+		{
+			return;
+		}
+		size_type bits = 8 * sizeof(unsigned long);
+		std::vector<unsigned long> mask(1);
+		for(size_type i = 0; i < nodes.size(); i++)
+		{
+			size_type id = ids[nodes[i]];
+			if(id / bits >= mask.size())
+			{
+				mask.resize(id / bits + 1, 0);
+			}
+			mask[id / bits] |= 1UL << (id % bits);
+		}
+		// The kernel reads one bit less than maxnode.
+		syscall(SYS_set_mempolicy, mode, nodes.empty() ? 0 : &mask[0], nodes.empty() ? 0 : mask.size() * bits + 1);
+	}
+
+	inline
+	void
+	numatopology::interleave() const
+	{
+		std::vector<size_type> all;
+		for(size_type i = 0; i < cpus.size(); i++)
+		{
+			all.push_back(i);
+		}
+		// MPOL_INTERLEAVE
+		setpolicy(3, all);
+	}
+
+	inline
+	void
+	numatopology::prefer(size_type i) const
+	{
+		// MPOL_PREFERRED, falls back to other nodes when node i is full.
+		setpolicy(1, std::vector<size_type>(1, i));
+	}
+
+	inline
+	void
+	numatopology::reset() const
+	{
+		// MPOL_DEFAULT
+		setpolicy(0, std::vector<size_type>());
+	}
+
+	inline
+	mappedfile
+	numatopology::copy(const mappedfile& m) const
+	{
+		if(!m.good())
+		{
+			return m;
+		}
+		void* addr = mmap(0, m.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(addr == MAP_FAILED)
+		{
+			std::cerr << "Unable to copy the index, using the mapped file" << std::endl;
+			return m;
+		}
+#ifdef MADV_HUGEPAGE
+		madvise(addr, m.size(), MADV_HUGEPAGE);
+#endif
+		// The pages are placed as they are first written.
+		memcpy(addr, m.data(), m.size());
+		mprotect(addr, m.size(), PROT_READ);
+		return mappedfile(addr, m.size());
+	}
+
+	//
+	// numareplicas functions:
+	//
+
+	template <class S>
+	numareplicas<S>::numareplicas(const std::string& f, numaplacement how)
+	{
+		mappedfile m(f);
+		if(how == NUMASHARED || !m.good())
+		{
+			replicas.push_back(new S(m));
+			return;
+		}
+		if(how == NUMAINTERLEAVE || topology.nodes() == 1)
+		{
+			topology.interleave();
+			replicas.push_back(new S(topology.copy(m)));
+			topology.reset();
+			return;
+		}
+		cpu_set_t original;
+		bool restore = pthread_getaffinity_np(pthread_self(), sizeof(original), &original) == 0;
+		for(size_type i = 0; i < topology.nodes(); i++)
+		{
+			topology.pin(i);
+			topology.prefer(i);
+			replicas.push_back(new S(topology.copy(m)));
+		}
+		topology.reset();
+		if(restore)
+		{
+			pthread_setaffinity_np(pthread_self(), sizeof(original), &original);
+		}
+	}
+
+	template <class S>
+	numareplicas<S>::~numareplicas()
+	{
+		for(size_type i = 0; i < replicas.size(); i++)
+		{
+			delete replicas[i];
+		}
+	}
+
+	template <class S>
+	S&
+	numareplicas<S>::pin(unsigned int w)
+	{
+		size_type node = w % topology.nodes();
+		topology.pin(node);
+		return replica(node);
+	}
+
+}
+#endif // __numa__
+// end of file: numa.h
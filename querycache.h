@@ -0,0 +1,290 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: querycache.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the query cache of the suffix array package.
+// The class querycache keeps the answers of find_all_positions_count for
+// the most frequent queries, in shards that are replaced with the CLOCK
+// algorithm, so several threads can use it at once.
+// It is defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __querycache__
+#define __querycache__
+
+#include <pthread.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <utility>
+
+namespace ns_suffixarray {
+
+  // Caches find_all_positions_count of an index of type I, which may be a suffixarray, an
+  // internedsuffixarray, a documentarray or anything else with a const find_all_positions_count
+  // and value_type, element_type and size_type typedefs. The cache is keyed by the query and the
+  // wildcard and split in shards by a hash of the query, each with its own lock. A full shard
+  // replaces an entry that was not used since the clock hand last passed it.
+  // The index must not change while it is cached.
+  template <class I>
+    class querycache {
+  public:
+    typedef I index_type;
+    typedef typename I::value_type value_type;
+    typedef typename I::element_type element_type;
+    typedef typename I::size_type size_type;
+
+    // Caches up to capacity answers of index (rounded up to a multiple of shards) in the given
+    // number of shards. Queries longer than maxlength are answered by the index and not cached.
+    querycache(const index_type& index, size_type capacity, size_type maxlength = 8, unsigned int shards = 16);
+    ~querycache();
+
+    // Same as find_all_positions_count of the index.
+    size_type
+      find_all_positions_count(const value_type& w, element_type wildcard = element_type()) const;
+
+    // Same, but a query that is not cached is answered by on, which must have the same content
+    // as the index (such as a replica of it on the node of the calling thread).
+    size_type
+      find_all_positions_count(const index_type& on, const value_type& w, element_type wildcard = element_type()) const;
+
+    // Answers every query of file f (one per line) to fill the cache, stops when the cache is
+    // full. Returns the number of queries read, or -1 if f can not be read.
+    size_type
+      prewarm(const std::string& f);
+
+    // Returns the number of answers found in, and not found in, the cache.
+    size_type
+      gethits() const { return (size_type) hits; };
+
+    size_type
+      getmisses() const { return (size_type) misses; };
+
+    // Returns the number of cached answers.
+    size_type
+      size() const { return (size_type) entries; };
+
+    // Returns the maximum number of cached answers.
+    size_type
+      capacity() const { return pershard * shards.size(); };
+
+  private:
+    typedef std::pair<value_type, element_type> key_type;
+    // Where each query is, per wildcard, so a query is looked up without copying it.
+    typedef std::map<value_type, size_type> slotmap;
+
+    // One part of the cache: the entries in clock order and where each key is.
+    class shard
+    {
+    public:
+      shard() { pthread_rwlock_init(&lock, 0); hand = 0; };
+      ~shard() { pthread_rwlock_destroy(&lock); };
+      std::map<element_type, slotmap> slots;
+      std::vector<key_type> keys;
+      std::vector<size_type> counts;
+      // Set when an entry is used, cleared when the hand passes. Readers set it with an
+      // atomic operation, it is only cleared under the write lock.
+      std::vector<char> used;
+      size_type hand;
+      pthread_rwlock_t lock;
+    };
+
+    // Returns the shard of w.
+    shard&
+      find_shard(const value_type& w) const;
+
+    // Hashes one element of a query.
+    static size_type
+      hashelement(const std::string& e);
+
+    template <class T>
+      static size_type
+      hashelement(const T& e) { return (size_type) e; }
+
+    // Not copyable.
+    querycache(const querycache&);
+    querycache& operator=(const querycache&);
+
+    const index_type& index;
+    std::vector<shard*> shards;
+    size_type pershard;
+    size_type maxlength;
+    mutable volatile long hits;
+    mutable volatile long misses;
+    // The number of cached answers.
+    mutable volatile long entries;
+  };
+
+	//
+	// querycache functions:
+	//
+
+	template <class I>
+	querycache<I>::querycache(const index_type& i, size_type c, size_type m, unsigned int n):
+		index(i), pershard(0), maxlength(m), hits(0), misses(0), entries(0)
+	{
+		if(n == 0)
+		{
+			n = 1;
+		}
+		for(unsigned int s = 0; s < n; s++)
+		{
+			shards.push_back(new shard());
+		}
+		pershard = (c + n - 1) / n;
+	}
+
+	template <class I>
+	querycache<I>::~querycache()
+	{
+		for(size_type s = 0; s < shards.size(); s++)
+		{
+			delete shards[s];
+		}
+	}
+
+	template <class I>
+	typename querycache<I>::size_type
+	querycache<I>::hashelement(const std::string& e)
+	{
+		size_type uit = 5381;
+		for(size_type i = 0; i < e.size(); i++)
+		{
+			uit = uit * 33 + (unsigned char) e[i];
+		}
+		return uit;
+	}
+
+	template <class I>
+	typename querycache<I>::shard&
+	querycache<I>::find_shard(const value_type& w) const
+	{
+		size_type h = 0;
+		for(size_type i = 0; i < w.size(); i++)
+		{
+			h = h * 1000003 ^ hashelement(w[i]);
+		}
+		return *shards[(h ^ (h >> 16)) % shards.size()];
+	}
+
+	template <class I>
+	typename querycache<I>::size_type
+	querycache<I>::find_all_positions_count(const value_type& w, element_type wildcard) const
+	{
+		return find_all_positions_count(index, w, wildcard);
+	}
+
+	template <class I>
+	typename querycache<I>::size_type
+	querycache<I>::find_all_positions_count(const index_type& on, const value_type& w, element_type wildcard) const
+	{
+		if(w.size() > maxlength || pershard == 0)
+		{
+			__sync_fetch_and_add(&misses, 1);
+			return on.find_all_positions_count(w, wildcard);
+		}
+		shard& s = find_shard(w);
+		pthread_rwlock_rdlock(&s.lock);
+		typename std::map<element_type, slotmap>::const_iterator byw = s.slots.find(wildcard);
+		if(byw != s.slots.end())
+		{
+			typename slotmap::const_iterator it = byw->second.find(w);
+			if(it != byw->second.end())
+			{
+				size_type uit = s.counts[it->second];
+				// Several readers may set the same flag at once.
+				__sync_lock_test_and_set(&s.used[it->second], 1);
+				pthread_rwlock_unlock(&s.lock);
+				__sync_fetch_and_add(&hits, 1);
+				return uit;
+			}
+		}
+		pthread_rwlock_unlock(&s.lock);
+		__sync_fetch_and_add(&misses, 1);
+		size_type uit = on.find_all_positions_count(w, wildcard);
+		pthread_rwlock_wrlock(&s.lock);
+		slotmap& m = s.slots[wildcard];
+		if(m.find(w) == m.end())
+		{
+			if(s.keys.size() < pershard)
+			{
+				m[w] = s.keys.size();
+				s.keys.push_back(key_type(w, wildcard));
+				s.counts.push_back(uit);
+				s.used.push_back(0);
+				__sync_fetch_and_add(&entries, 1);
+			}
+			else
+			{
+				while(s.used[s.hand])
+				{
+					s.used[s.hand] = 0;
+					s.hand = (s.hand + 1) % pershard;
+				}
+				key_type& old = s.keys[s.hand];
+				s.slots[old.second].erase(old.first);
+				m[w] = s.hand;
+				old.first = w;
+				old.second = wildcard;
+				s.counts[s.hand] = uit;
+				s.hand = (s.hand + 1) % pershard;
+			}
+		}
+		pthread_rwlock_unlock(&s.lock);
+		return uit;
+	}
+
+	template <class I>
+	typename querycache<I>::size_type
+	querycache<I>::prewarm(const std::string& f)
+	{
+		std::ifstream is(f.c_str());
+		if(!is)
+		{
+			std::cerr << "Unable to open file " << f << std::endl;
+			return (size_type) -1;
+		}
+		size_type uit = 0;
+		std::string line;
+		while(size() < capacity() && std::getline(is, line))
+		{
+			value_type w;
+			std::istringstream a(line);
+			a >> w;
+			find_all_positions_count(w);
+			uit++;
+		}
+		// Only count the queries answered afterwards.
+		hits = 0;
+		misses = 0;
+		return uit;
+	}
+
+}
+#endif // __querycache__
+// end of file: querycache.h
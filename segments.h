@@ -0,0 +1,655 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: segments.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the appendable index of the suffix array package.
+// The class segmentedindex stores a growing text as a list of immutable
+// segments, each with its own suffixarray. Appending text builds a new
+// segment, small segments are merged in the background. Queries are
+// answered on all segments, including occurrences spanning a border.
+// segmentedindex is defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __segments__
+#define __segments__
+
+#include <pthread.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include "suffixarray.h"
+
+namespace ns_suffixarray {
+
+  // An index on a text that grows at the end.
+  // The text is the concatenation of all appended texts and is stored in segments. Every
+  // segment holds a part of the text followed by the sentinel and a suffixarray on that.
+  // Positions returned by the queries are positions in the whole text, the answers are the
+  // same as those of one suffixarray on the whole text followed by the sentinel.
+  // The sentinel must be larger than every element of the text.
+  //
+  // Segments are merged with a tiered policy: whenever the newest mergefactor segments
+  // are about the same size they are replaced by one segment. Merges run on a
+  // background thread, or within append() if background is false. Queries and appends
+  // may be done from several threads, queries see every text appended before they start.
+  template <class V>
+    class segmentedindex {
+  public:
+    typedef V value_type;
+    typedef suffixarray<V> index_type;
+    typedef typename index_type::size_type size_type;
+    typedef typename index_type::element_type element_type;
+
+    // Creates an empty index.
+    // method and threads are used to build the suffixarray of every segment.
+    segmentedindex(element_type sentinel, size_type mergefactor = 10, bool background = true, sortmethod method = DEEPSHALLOW, unsigned int threads = 1);
+
+    // Stops the background merges and frees all segments.
+    ~segmentedindex();
+
+    // Appends text to the index as a new segment.
+    // Returns false, and leaves the index unchanged, if text contains an element
+    // that is not smaller than the sentinel.
+    bool
+      append(const value_type& text);
+
+    // Does all merges the policy asks for now, waiting for the background thread if needed.
+    void
+      merge();
+
+    // Merges all segments into one.
+    void
+      compact();
+
+    // Returns the length of the text.
+    size_type
+      size() const;
+
+    // Returns the number of segments.
+    size_type
+      segments() const;
+
+    // Returns the element at position p of the text, the sentinel at size().
+    element_type
+      at(size_type p) const;
+
+    // Same as suffixarray::find_position.
+    size_type
+      find_position(const value_type& w, element_type wildcard = element_type()) const;
+
+    // Same as suffixarray::find_all_positions.
+    std::vector<size_type>
+      find_all_positions(const value_type& w, element_type wildcard = element_type()) const;
+
+    // Same as suffixarray::find_all_positions_count.
+    size_type
+      find_all_positions_count(const value_type& w, element_type wildcard = element_type()) const;
+
+    // Same as suffixarray::find_all_positions_skip.
+    std::vector<size_type>
+      find_all_positions_skip(const std::vector<value_type>& w, size_type minskip, size_type maxskip, element_type wildcard = element_type()) const;
+
+    // Same as suffixarray::find_all_positions_skip_count.
+    size_type
+      find_all_positions_skip_count(const std::vector<value_type>& w, size_type minskip, size_type maxskip, element_type wildcard = element_type()) const;
+
+  private:
+    // A part of the text, followed by the sentinel, and its suffixarray.
+    // The content is not changed after build().
+    class segment
+    {
+    public:
+      segment(size_type o): sarr(0), offset(o) {};
+      ~segment() { delete sarr; };
+      // Builds the suffixarray, content must be filled in.
+      void build(sortmethod method, unsigned int threads) { sarr = new index_type(content, method, threads); };
+      // Returns the length of the part of the text.
+      size_type length() const { return content.size() - 1; };
+      V content;
+      index_type* sarr;
+      // The position of the first element in the text.
+      size_type offset;
+    };
+
+    // Returns the segment holding position p of the text, segs must not be empty.
+    size_type
+      find_segment(size_type p) const;
+
+    // Returns the element at position p of the text, without locking.
+    element_type
+      element(size_type p) const;
+
+    // Returns true if w matches the text at position p, as the suffixarray would match it.
+    bool
+      matches(size_type p, const value_type& w, element_type wildcard) const;
+
+    // Returns true if w matches the content of segment s at position p.
+    bool
+      matches(const segment* s, size_type p, const value_type& w, element_type wildcard) const;
+
+    // Returns the first position of segment s at which a match can run into the next segment.
+    size_type
+      border(const segment* s, const value_type& w) const;
+
+    // Chooses the segments [first,last) to merge, returns false if none.
+    bool
+      choose(size_type& first, size_type& last) const;
+
+    // Replaces the segments [first,last) by one segment.
+    void
+      merge(size_type first, size_type last);
+
+    // The loop of the background thread.
+    void
+      run();
+
+    // Entry point of the background thread.
+    static void*
+      start(void* args);
+
+    // Not copyable.
+    segmentedindex(const segmentedindex&);
+    segmentedindex& operator=(const segmentedindex&);
+
+    // The segments, oldest first.
+    std::vector<segment*> segs;
+
+    // Protects segs, queries read and appends and merges write.
+    mutable pthread_rwlock_t lock;
+
+    // Held while merging, so only one merge runs at a time.
+    pthread_mutex_t merging;
+
+    // Wakes up the background thread.
+    pthread_mutex_t waiting;
+    pthread_cond_t wakeup;
+    bool pending;
+    bool stopping;
+
+    pthread_t merger;
+    bool background;
+
+    element_type sentinel;
+    size_type mergefactor;
+    sortmethod method;
+    unsigned int threads;
+  };
+
+	//
+	// segmentedindex public functions:
+	//
+
+	template <class V>
+	segmentedindex<V>::segmentedindex(element_type s, size_type f, bool b, sortmethod m, unsigned int t):
+		pending(false), stopping(false), background(b), sentinel(s), mergefactor(f < 2 ? 2 : f), method(m), threads(t)
+	{
+		pthread_rwlock_init(&lock, 0);
+		pthread_mutex_init(&merging, 0);
+		pthread_mutex_init(&waiting, 0);
+		pthread_cond_init(&wakeup, 0);
+		if(background && pthread_create(&merger, 0, &segmentedindex<V>::start, this) != 0)
+		{
+			std::cerr << "Could not start the merge thread, merging while appending." << std::endl;
+			background = false;
+		}
+	}
+
+	template <class V>
+	segmentedindex<V>::~segmentedindex()
+	{
+		if(background)
+		{
+			pthread_mutex_lock(&waiting);
+			stopping = true;
+			pthread_cond_signal(&wakeup);
+			pthread_mutex_unlock(&waiting);
+			pthread_join(merger, 0);
+		}
+		for(size_type i = 0; i < segs.size(); i++)
+		{
+			delete segs[i];
+		}
+		pthread_cond_destroy(&wakeup);
+		pthread_mutex_destroy(&waiting);
+		pthread_mutex_destroy(&merging);
+		pthread_rwlock_destroy(&lock);
+	}
+
+	template <class V>
+	bool
+	segmentedindex<V>::append(const value_type& text)
+	{
+		for(size_type i = 0; i < text.size(); i++)
+		{
+			if(!(text[i] < sentinel))
+			{
+				std::cerr << "Element " << i << " of the appended text is not smaller than the sentinel." << std::endl;
+				return false;
+			}
+		}
+		if(text.size() == 0)
+		{
+			return true;
+		}
+		// The suffixarray is build before taking the lock, the offset is set once the position is known.
+		segment* s = new segment(0);
+		s->content.insert(s->content.end(), text.begin(), text.end());
+		s->content.push_back(sentinel);
+		s->build(method, threads);
+		pthread_rwlock_wrlock(&lock);
+		if(!segs.empty())
+		{
+			s->offset = segs.back()->offset + segs.back()->length();
+		}
+		segs.push_back(s);
+		pthread_rwlock_unlock(&lock);
+		if(background)
+		{
+			pthread_mutex_lock(&waiting);
+			pending = true;
+			pthread_cond_signal(&wakeup);
+			pthread_mutex_unlock(&waiting);
+		}
+		else
+		{
+			merge();
+		}
+		return true;
+	}
+
+	template <class V>
+	void
+	segmentedindex<V>::merge()
+	{
+		pthread_mutex_lock(&merging);
+		size_type first, last;
+		while(choose(first, last))
+		{
+			merge(first, last);
+		}
+		pthread_mutex_unlock(&merging);
+	}
+
+	template <class V>
+	void
+	segmentedindex<V>::compact()
+	{
+		pthread_mutex_lock(&merging);
+		pthread_rwlock_rdlock(&lock);
+		size_type last = segs.size();
+		pthread_rwlock_unlock(&lock);
+		if(last > 1)
+		{
+			merge(0, last);
+		}
+		pthread_mutex_unlock(&merging);
+	}
+
+	template <class V>
+	typename segmentedindex<V>::size_type
+	segmentedindex<V>::size() const
+	{
+		pthread_rwlock_rdlock(&lock);
+		size_type uit = segs.empty() ? 0 : segs.back()->offset + segs.back()->length();
+		pthread_rwlock_unlock(&lock);
+		return uit;
+	}
+
+	template <class V>
+	typename segmentedindex<V>::size_type
+	segmentedindex<V>::segments() const
+	{
+		pthread_rwlock_rdlock(&lock);
+		size_type uit = segs.size();
+		pthread_rwlock_unlock(&lock);
+		return uit;
+	}
+
+	template <class V>
+	typename segmentedindex<V>::element_type
+	segmentedindex<V>::at(size_type p) const
+	{
+		pthread_rwlock_rdlock(&lock);
+		element_type uit = element(p);
+		pthread_rwlock_unlock(&lock);
+		return uit;
+	}
+
+	template <class V>
+	typename segmentedindex<V>::size_type
+	segmentedindex<V>::find_position(const value_type& w, element_type wildcard) const
+	{
+		pthread_rwlock_rdlock(&lock);
+		if(segs.empty() && matches(0, w, wildcard))
+		{
+			// The text is only the sentinel.
+			pthread_rwlock_unlock(&lock);
+			return 0;
+		}
+		for(size_type i = 0; i < segs.size(); i++)
+		{
+			const segment* s = segs[i];
+			// In the last segment every match is a match in the text.
+			size_type b = i + 1 == segs.size() ? s->content.size() : border(s, w);
+			try
+			{
+				size_type p = s->sarr->find_position(w, wildcard);
+				if(p < b)
+				{
+					// A merge may delete s once the lock is released.
+					size_type uit = s->offset + p;
+					pthread_rwlock_unlock(&lock);
+					return uit;
+				}
+			}
+			catch(StringNotFound&)
+			{
+				continue;
+			}
+			// The match found runs into the sentinel, look for another one.
+			std::vector<size_type> found = s->sarr->find_all_positions(w, wildcard);
+			for(size_type j = 0; j < found.size(); j++)
+			{
+				if(found[j] < b)
+				{
+					size_type uit = s->offset + found[j];
+					pthread_rwlock_unlock(&lock);
+					return uit;
+				}
+			}
+		}
+		for(size_type i = 0; i + 1 < segs.size(); i++)
+		{
+			const segment* s = segs[i];
+			for(size_type p = border(s, w); p < s->length(); p++)
+			{
+				if(matches(s->offset + p, w, wildcard))
+				{
+					size_type uit = s->offset + p;
+					pthread_rwlock_unlock(&lock);
+					return uit;
+				}
+			}
+		}
+		pthread_rwlock_unlock(&lock);
+		throw StringNotFound();
+	}
+
+	template <class V>
+	std::vector<typename segmentedindex<V>::size_type>
+	segmentedindex<V>::find_all_positions(const value_type& w, element_type wildcard) const
+	{
+		std::vector<size_type> results;
+		pthread_rwlock_rdlock(&lock);
+		if(segs.empty() && matches(0, w, wildcard))
+		{
+			// The text is only the sentinel.
+			results.push_back(0);
+		}
+		for(size_type i = 0; i < segs.size(); i++)
+		{
+			const segment* s = segs[i];
+			std::vector<size_type> found = s->sarr->find_all_positions(w, wildcard);
+			if(i + 1 == segs.size())
+			{
+				for(size_type j = 0; j < found.size(); j++)
+				{
+					results.push_back(s->offset + found[j]);
+				}
+				continue;
+			}
+			// Near the border the segment is checked against the text itself.
+			size_type b = border(s, w);
+			for(size_type j = 0; j < found.size(); j++)
+			{
+				if(found[j] < b)
+				{
+					results.push_back(s->offset + found[j]);
+				}
+			}
+			for(size_type p = b; p < s->length(); p++)
+			{
+				if(matches(s->offset + p, w, wildcard))
+				{
+					results.push_back(s->offset + p);
+				}
+			}
+		}
+		pthread_rwlock_unlock(&lock);
+		return results;
+	}
+
+	template <class V>
+	typename segmentedindex<V>::size_type
+	segmentedindex<V>::find_all_positions_count(const value_type& w, element_type wildcard) const
+	{
+		size_type result = 0;
+		pthread_rwlock_rdlock(&lock);
+		if(segs.empty() && matches(0, w, wildcard))
+		{
+			// The text is only the sentinel.
+			result = 1;
+		}
+		for(size_type i = 0; i < segs.size(); i++)
+		{
+			const segment* s = segs[i];
+			result += s->sarr->find_all_positions_count(w, wildcard);
+			if(i + 1 == segs.size())
+			{
+				continue;
+			}
+			// Replace the matches near the border by the matches in the text.
+			for(size_type p = border(s, w); p <= s->length(); p++)
+			{
+				if(matches(s, p, w, wildcard))
+				{
+					result--;
+				}
+				if(p < s->length() && matches(s->offset + p, w, wildcard))
+				{
+					result++;
+				}
+			}
+		}
+		pthread_rwlock_unlock(&lock);
+		return result;
+	}
+
+	template <class V>
+	std::vector<typename segmentedindex<V>::size_type>
+	segmentedindex<V>::find_all_positions_skip(const std::vector<value_type>& w, size_type minskip, size_type maxskip, element_type wildcard) const
+	{
+		std::vector< std::vector<size_type> > idx;
+		for(size_type i = 0; i < w.size(); i++)
+		{
+			idx.push_back(find_all_positions(w[i], wildcard));
+			sort(idx.back().begin(), idx.back().end());
+		}
+		return index_type::join_skip_positions(idx, minskip, maxskip);
+	}
+
+	template <class V>
+	typename segmentedindex<V>::size_type
+	segmentedindex<V>::find_all_positions_skip_count(const std::vector<value_type>& w, size_type minskip, size_type maxskip, element_type wildcard) const
+	{
+		return (size_type) find_all_positions_skip(w, minskip, maxskip, wildcard).size();
+	}
+
+	//
+	// segmentedindex private functions:
+	//
+
+	template <class V>
+	typename segmentedindex<V>::size_type
+	segmentedindex<V>::find_segment(size_type p) const
+	{
+		size_type lo = 0;
+		size_type hi = segs.size();
+		while(hi - lo > 1)
+		{
+			size_type mid = lo + (hi - lo) / 2;
+			if(segs[mid]->offset <= p)
+			{
+				lo = mid;
+			}
+			else
+			{
+				hi = mid;
+			}
+		}
+		return lo;
+	}
+
+	template <class V>
+	typename segmentedindex<V>::element_type
+	segmentedindex<V>::element(size_type p) const
+	{
+		if(segs.empty())
+		{
+			return sentinel;
+		}
+		const segment* s = segs[find_segment(p)];
+		// Past the last segment this is the sentinel of the last segment.
+		return s->content[std::min(p - s->offset, s->length())];
+	}
+
+	template <class V>
+	bool
+	segmentedindex<V>::matches(size_type p, const value_type& w, element_type wildcard) const
+	{
+		size_type end = segs.empty() ? 1 : segs.back()->offset + segs.back()->content.size();
+		for(size_type d = 0; d < w.size(); d++)
+		{
+			if(w[d] == wildcard)
+			{
+				continue;
+			}
+			if(p + d >= end || !(w[d] == element(p + d)))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template <class V>
+	bool
+	segmentedindex<V>::matches(const segment* s, size_type p, const value_type& w, element_type wildcard) const
+	{
+		for(size_type d = 0; d < w.size(); d++)
+		{
+			if(w[d] == wildcard)
+			{
+				continue;
+			}
+			if(p + d >= s->content.size() || !(w[d] == s->content[p + d]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template <class V>
+	typename segmentedindex<V>::size_type
+	segmentedindex<V>::border(const segment* s, const value_type& w) const
+	{
+		// A match of w at p uses the elements up to p + |w| - 1, which must lie within the
+		// part of the text. The position of the sentinel itself is never a position of the text.
+		size_type n = std::max(w.size(), (typename V::size_type) 1);
+		return s->length() + 1 > n ? s->length() + 1 - n : 0;
+	}
+
+	template <class V>
+	bool
+	segmentedindex<V>::choose(size_type& first, size_type& last) const
+	{
+		pthread_rwlock_rdlock(&lock);
+		last = segs.size();
+		bool uit = last >= mergefactor && segs[last-mergefactor]->length() < mergefactor * segs[last-1]->length();
+		first = uit ? last - mergefactor : 0;
+		pthread_rwlock_unlock(&lock);
+		return uit;
+	}
+
+	template <class V>
+	void
+	segmentedindex<V>::merge(size_type first, size_type last)
+	{
+		// Only appends change segs meanwhile, which leaves [first,last) where it is.
+		pthread_rwlock_rdlock(&lock);
+		std::vector<segment*> old(segs.begin() + first, segs.begin() + last);
+		pthread_rwlock_unlock(&lock);
+		segment* s = new segment(old.front()->offset);
+		for(size_type i = 0; i < old.size(); i++)
+		{
+			s->content.insert(s->content.end(), old[i]->content.begin(), old[i]->content.end() - 1);
+		}
+		s->content.push_back(sentinel);
+		s->build(method, threads);
+		pthread_rwlock_wrlock(&lock);
+		segs.erase(segs.begin() + first, segs.begin() + last);
+		segs.insert(segs.begin() + first, s);
+		pthread_rwlock_unlock(&lock);
+		// No query uses the old segments anymore once the write lock was granted.
+		for(size_type i = 0; i < old.size(); i++)
+		{
+			delete old[i];
+		}
+	}
+
+	template <class V>
+	void
+	segmentedindex<V>::run()
+	{
+		while(true)
+		{
+			pthread_mutex_lock(&waiting);
+			while(!pending && !stopping)
+			{
+				pthread_cond_wait(&wakeup, &waiting);
+			}
+			bool stop = stopping;
+			pending = false;
+			pthread_mutex_unlock(&waiting);
+			if(stop)
+			{
+				return;
+			}
+			merge();
+		}
+	}
+
+	template <class V>
+	void*
+	segmentedindex<V>::start(void* args)
+	{
+		((segmentedindex<V>*) args)->run();
+		return 0;
+	}
+
+}
+#endif // __segments__
+// end of file: segments.h
@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: storage.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the storage policies of the suffix array package.
+// A storagepolicy is the second template parameter of suffixarray and
+// chooses the type of the suffix array entries and of the lcp and child
+// table cells. packedindex is a 40 bit suffix array entry.
+// Both are defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __storage__
+#define __storage__
+
+#include <stdint.h>
+#include <limits>
+
+namespace ns_suffixarray {
+
+  // An unsigned integer of 40 bits stored in 5 bytes, for suffix arrays of corpora
+  // with up to 2^40 elements. Converts to and from uint64_t.
+  class packedindex {
+  public:
+    packedindex() { set(0); };
+    packedindex(uint64_t v) { set(v); };
+
+    operator uint64_t() const;
+
+  private:
+    void
+      set(uint64_t v);
+
+    unsigned char bytes[5];
+  };
+
+  // Chooses how a suffixarray stores its tables:
+  // I is the type of the suffix array entries, which must hold every position of the corpus,
+  // for instance uint32_t, packedindex or uint64_t.
+  // L is the unsigned type of the lcp cells, larger values are exceptions.
+  // C is the signed type of the child table cells, which hold relative positions.
+  // Wider cells take more memory but store fewer exceptions.
+  template <class I, class L = unsigned char, class C = signed char>
+    class storagepolicy {
+  public:
+    typedef I index_type;
+    typedef L lcp_type;
+    typedef C child_type;
+  };
+
+	//
+	// packedindex functions:
+	//
+
+	inline
+	packedindex::operator uint64_t() const
+	{
+		return (uint64_t) bytes[0] | (uint64_t) bytes[1] << 8 | (uint64_t) bytes[2] << 16 | (uint64_t) bytes[3] << 24 | (uint64_t) bytes[4] << 32;
+	}
+
+	inline
+	void
+	packedindex::set(uint64_t v)
+	{
+		for(unsigned int b = 0; b < 5; b++)
+		{
+			bytes[b] = (unsigned char) (v >> (8 * b));
+		}
+	}
+
+}
+
+namespace std {
+
+  // The range of a packedindex, used to check that a corpus fits.
+  template <>
+    class numeric_limits<ns_suffixarray::packedindex> {
+  public:
+    static const bool is_specialized = true;
+    static const bool is_signed = false;
+    static const bool is_integer = true;
+    static const int digits = 40;
+    static ns_suffixarray::packedindex min() { return ns_suffixarray::packedindex(0); };
+    static ns_suffixarray::packedindex max() { return ns_suffixarray::packedindex(((uint64_t) 1 << 40) - 1); };
+  };
+
+}
+#endif // __storage__
+// end of file: storage.h
@@ -50,19 +50,114 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <map>
 #include <vector>
 #include <stack>
 #include <algorithm>
 #include <string>
 #include <set>
+#include <limits>
+#include <queue>
+#include <cstdio>
+#include <unistd.h>
+#include "threadpool.h"
+#include "buildstats.h"
+#include "flatarray.h"
+#include "storage.h"
+#include "bitvector.h"
+#include "mappedfile.h"
+#include "archive.h"
 
 namespace ns_suffixarray {
   
   class StringNotFound {
   }; // Exception
   
-  template <class V>
+  // Selects the algorithm used to sort the suffixes when building a suffixarray.
+  // DEEPSHALLOW sorts buckets of the first two elements with a blind trie,
+  // its running time grows with the lcp of the corpus.
+  // INDUCEDSORTING uses SA-IS (Nong, Zhang and Chan 2009) on the ranks of the
+  // elements and runs in O(n) time regardless of the lcp.
+  enum sortmethod { DEEPSHALLOW, INDUCEDSORTING };
+  
+  // Maps the elements of a sequence onto their ranks 1..k (0 is reserved for the
+  // virtual sentinel used by SA-IS). Generic version: sorts the distinct elements.
+  template <class E, bool integer = std::numeric_limits<E>::is_integer>
+    class elementranks {
+  public:
+    template <class V, class S>
+      static S
+      rank(const V& content, std::vector<S>& t);
+  };
+  
+  // Integer alphabets (such as interned tokens) with a value range not larger than
+  // the sequence are ranked in linear time by counting.
+  template <class E>
+    class elementranks<E,true> {
+  public:
+    template <class V, class S>
+      static S
+      rank(const V& content, std::vector<S>& t);
+  };
+  
+  // Finds a child of the root of a suffixarray by its first element. first(k) returns the
+  // first element of child k, the children are ordered by it.
+  // Generic version: binary search on the first elements.
+  template <class E, bool integer = std::numeric_limits<E>::is_integer>
+    class rootdirectory {
+  public:
+    // Prepares find() for the n children.
+    template <class F>
+      void
+      build(const F&, unsigned long) {}
+
+    // Returns the child of the n children whose first element is e, n if there is none.
+    template <class F>
+      unsigned long
+      find(const F& first, unsigned long n, const E& e) const { return search(first, 0, n, e); }
+
+    void
+      clear() {}
+
+    // Returns the child of [lo,hi) whose first element is e, hi if there is none.
+    template <class F>
+      static unsigned long
+      search(const F& first, unsigned long lo, unsigned long hi, const E& e);
+  };
+
+  // Integer elements (such as interned tokens) index a table of the children directly, as far
+  // as their values are dense. The largest elements (like a sentinel) are left out of the table
+  // while they would make it sparse, those children are found by binary search.
+  template <class E>
+    class rootdirectory<E,true> {
+  public:
+    rootdirectory(): base(0), covered(0) {};
+
+    template <class F>
+      void
+      build(const F& first, unsigned long n);
+
+    template <class F>
+      unsigned long
+      find(const F& first, unsigned long n, const E& e) const;
+
+    void
+      clear() { std::vector<unsigned long>().swap(slots); covered = 0; };
+
+  private:
+    // The smallest first element.
+    E base;
+    // For every value from base on the child starting with it, (unsigned long) -1 if none.
+    std::vector<unsigned long> slots;
+    // The children [0,covered) are in slots.
+    unsigned long covered;
+  };
+
+  // The suffixarray of a sequence of type V.
+  // P is the storagepolicy (see storage.h) choosing the type of the suffix array entries and
+  // of the lcp and child table cells, by default entries of V::size_type and byte cells.
+  template <class V, class P = storagepolicy<typename V::size_type> >
     class suffixarray {
     
   public:
@@ -70,20 +165,11 @@ namespace ns_suffixarray {
     typedef typename value_type::size_type size_type;
     typedef typename value_type::value_type element_type;
     typedef typename value_type::const_iterator index;
-    
-    
-  protected:
-    // SACmp class is used (anonymously) to do the sorting of the suffix array.
-    class SACmp
-    {
-    public:
-	SACmp( const value_type& content, int mi, int ma ): cont(content), min(mi), max(ma) {};
-	bool operator()(size_type x, size_type y) const;
-    private:
-      const value_type& cont;
-      int min;
-	  int max;
-    };
+    typedef P policy_type;
+    // The type of the suffix array entries.
+    typedef typename P::index_type index_type;
+    typedef typename P::lcp_type lcp_type;
+    typedef typename P::child_type child_type;
     
     // Helper class, defines an interval on the suffixarray
     // i is the left-limit, j the right-limit
@@ -102,6 +188,41 @@ namespace ns_suffixarray {
       size_type j;      
     };
     
+    // Scratch buffers of the queries. Queries given the same querycontext reuse its buffers,
+    // so once these have grown a query does not allocate memory. The queries are const and
+    // may run on several threads at once, each with its own querycontext.
+    class querycontext
+    {
+    public:
+      // The intervals found by find_intervals.
+      std::vector<interval> current;
+      // The intervals still to search with the number of elements of the query they match,
+      // and the children of one interval.
+      std::vector< std::pair<interval, size_type> > pending;
+      std::vector<interval> children;
+      // The order of the queries of a batch and the rows [first,second) matching every
+      // prefix of the last query of the batch.
+      std::vector<size_type> order;
+      std::vector< std::pair<size_type, size_type> > ranges;
+    };
+    
+    
+  protected:
+    // Iterates over the suffix array.
+    typedef typename flatarray<index_type>::iterator saiterator;
+    
+    // SACmp class is used (anonymously) to do the sorting of the suffix array.
+    class SACmp
+    {
+    public:
+	SACmp( const value_type& content, int mi, int ma ): cont(content), min(mi), max(ma) {};
+	bool operator()(size_type x, size_type y) const;
+    private:
+      const value_type& cont;
+      int min;
+	  int max;
+    };
+    
     
     // This class keeps track of all the lcp, up, down and nextl values for a suffix-array.
     // Stores and retrieves the values transparently and efficiently (memory wise).
@@ -109,71 +230,104 @@ namespace ns_suffixarray {
     class childtabs
     {
     private:
-      // Stores the lcp array for lcp values < 255
-      // Exceptions stord as 255 with overflow in the lcpmap map.
-		std::vector<unsigned char> lcp;
+      // Stores the lcp array for lcp values < lcpescape (255 for bytes)
+      // Exceptions stord as lcpescape with overflow in the lcpmap table.
+		flatarray<lcp_type> lcp;
       // Stores all the exceptions to this
-		std::map<size_type,size_type> lcpmap;
+		exceptiontable<size_type> lcpmap;
       
       // Stores the up, down and nexl_index arrays in one place.
-      // As explained under algorithm 6.5 in "Replacing suffix threes with enhances suffix arrays"
-      // Stores relative indexes -128 < index < 127;
-      // if the index is outside of that stored as 127 with overflow in the allmap map.
-		//std::vector<signed char> all;
-      // Stores the exceptions to the all vector
-		//std::map<size_type,size_type> allmap;
-      
-		std::vector<signed char> up;
-		std::map<size_type,size_type> upmap;
-
-		std::vector<signed char> down;
-		std::map<size_type,size_type> downmap;
-
-		std::vector<signed char> nextl;
-		std::map<size_type,size_type> nextlmap;
-
+      // As explained in section 6.1 of "Replacing suffix trees with enhanced suffix arrays"
+      // position i holds up[i+1] if lcp[i] > lcp[i+1] (then nextl[i] and down[i] are undefined),
+      // otherwise nextl[i] if it is defined and else down[i], which is only needed when
+      // nextl[i] is undefined. The lcp values tell which of them a position holds.
+      // Stores relative indexes childnone < index < childescape (-128 and 127 for bytes);
+      // if the index is outside of that stored as childescape with overflow in the childmap table.
+		flatarray<child_type> child;
+      // Stores the exceptions to the child vector
+		exceptiontable<size_type> childmap;
 		
-      // Stores a value in the all vector and allmap map.
+      // Stores a value in the child vector and childmap table.
       void
-	store(std::vector<signed char>& vec, std::map<size_type,size_type>& map,size_type pos, size_type value);
+	store(size_type pos, size_type value);
       
-      // Retrieves a value from the all vector and allmap map.
+      // Retrieves a value from the child vector and childmap table.
       // Retrieves the same value as stored by store(pos, val).
       size_type
-		retrieve(std::vector<signed char>& vec, std::map<size_type,size_type>& map, size_type pos);
-      
-      // Returns true if the position contains a nextl value;
-      bool
-	isnextl(size_type pos) const;
+		retrieve(size_type pos) const;
       
       // Returns true if the position has an up value defined (stored on pos-1)
       bool
 	isup(size_type pos) const;
       
-      // Returns true if for the current position the down value should be stored/retrieved
-      // from pos
+      // Returns true if value, stored on pos, is the nextl value of pos and not its down value.
       bool
-	isdownl(size_type pos) const;
+	isnextl(size_type pos, size_type value) const;
       
-      // Returns true if for the current position the down value should be retrieved from
-      // pos+1
-      // NOTE: exception for pos == 0; add 1 to the value returned!
-      bool
-	isdownu(size_type pos) const;
+      // Tells freeze() which positions still hold the escape value, a cell that escaped
+      // and was overwritten with a value that fits has no exception any more.
+      template <class C, class E>
+      class escaped
+      {
+      public:
+	escaped(const flatarray<C>& c, E e): cells(c), escape(e) {};
+	bool operator()(size_type pos) const { return pos < cells.size() && (E) cells[pos] == escape; };
+      private:
+	const flatarray<C>& cells;
+	E escape;
+      };
       
     public:
+      // The lcp cell value marking an exception.
+      static size_type
+	lcpescape() { return (size_type) std::numeric_limits<lcp_type>::max(); };
+      
+      // The child cell values marking an undefined value and an exception.
+      static long
+	childnone() { return (long) std::numeric_limits<child_type>::min(); };
+      
+      static long
+	childescape() { return (long) std::numeric_limits<child_type>::max(); };
+      
       // Initialisation function.
       // To be called FIRST. size should equal the size of the suffix array to generate the values on.
       void
 	init_tabs(size_type size);
       
+      // Returns the size given to init_tabs.
+      size_type
+	size() const { return lcp.size(); };
+      
+      // Records the number of values stored in each exception map in stats.
+      void
+	countexceptions(buildstats& stats) const;
+      
+      // Freezes the exception tables, to be called before values are looked up in them.
+      void
+	freeze();
+      
+      // Adds the arrays and the (frozen) exception tables to w, childtabs::sections in all.
+      // W is a sectionwriter or an archivewriter.
+      template <class W>
+      void
+	addsections(W& w) const;
+      
+      // Uses the sections first... of r, as written by addsections: in place from a
+      // sectionreader, decoded from an archivereader. Returns false if they do not fit size.
+      template <class R>
+      bool
+	viewsections(const R& r, typename R::offset_type first, size_type size);
+      
+      // The number of sections written by addsections.
+      static const unsigned int sections = 8;
+      
       // Stores and lcp value at a certain position.
       void
 	setlcp(size_type pos, size_type value);
       
       // Retrieves an lcp value for a certain position.
       size_type
-	getlcp(size_type pos);
+	getlcp(size_type pos) const;
       
       // Stores a nextl value.
       void
@@ -182,7 +336,7 @@ namespace ns_suffixarray {
       // Retrieves the correct nextl value if it should be stored on position.
       // otherwise returns (size_type) -1
       size_type
-	getnextl(size_type pos);
+	getnextl(size_type pos) const;
       
       // Stores an up value if it should be stored in the correct position.
       void
@@ -191,78 +345,159 @@ namespace ns_suffixarray {
       // Retrieves an up value that corresponds to the current position from the correct place in the storage.
       // otherwise returns (size_type) -1
       size_type
-	getup(size_type pos);
+	getup(size_type pos) const;
       
-      // Stores an down value if it should be stored in the correct position
+      // Stores a down value, unless the position holds its nextl value already.
+      // The lcp values have to be set first.
       void
 	setdown(size_type pos, size_type value);
       
-      // Retrieves a down value from the current position if isdown(pos)
-      // if isdownu(pos) retrieves it from the correct up position
-      // otherwise returns (value_type) -1
+      // Retrieves the down value if it is stored on position (nextl is undefined).
+      // otherwise returns (size_type) -1
       size_type
-	getdown(size_type pos);
+	getdown(size_type pos) const;
     };
 	// Class to make a smart-building trie structure.
-	// Used to quickly sort a (small) part of the data
-	// Each isntance is a full Node, all nodes use the same class.
-	// A Node with an empty list of children is a leaf.
+	// Used to quickly sort a (small) part of the data, one bucket at a time.
+	// All nodes live in one flat arena and refer to each other by their index in it.
+	// Between buckets the arena is cleared but keeps its memory, so once it has grown
+	// to the size of the largest bucket sorting does not allocate anymore.
+	// Every thread sorting buckets needs its own sorttrie.
 	class sorttrie
 	{
 		private:
+		// A node of the trie, it represents cont[idx+depth].
+		// The children of a node form a binary search tree on their element:
+		// eq points to the first child, lo and hi to the siblings with a smaller
+		// and larger element. A node without children is a leaf.
+		class node
+		{
+			public:
+			node(size_type i, size_type d): idx(i), depth(d), lo(none), hi(none), eq(none) {};
+			size_type idx;
+			size_type depth;
+			size_type lo;
+			size_type hi;
+			size_type eq;
+		};
+		// Marks a missing node.
+		static const size_type none = (size_type) -1;
 		// A pointer to the actuall content of the parent suffixarray
 		const value_type& cont;
-		// The depth of the current node compared to its index.
-		size_type depth;
-		// The index of the current node one the content.
-		// such that it represents (a part of) the path of cont[idx].
-		size_type idx;
-		// A list of the children elements of this sorttrie.
-		std::map<element_type,sorttrie> children;
-		public:
-		// Constructor, makes a new sorttrie at depth d with index i.
-		// Index i denotes the important value of the sorttrie
-		// It points to content[i];
-		sorttrie(const value_type& content, size_type d, size_type i);
-		// Is this sorttrie a leaf? (all nodes start as leaves.
-		bool isLeaf() const {return children.size() == 0;};
-		// Makes a new child from self (at depth+1) and adds it to the children list.
-		// After this the sorttrie is no longer a leaf.
-		void makeChildSelf();
-		// Adds a child to the children list.
-		// IF this node is a leaf call makeChildSelf first!
-		void addChild(sorttrie child);
-		// Returns the element in the content to which this node points.
-		// so cont[idx+depth]
-		element_type getelem() const;
-		// Checks to see if the current node has a child which points to "el".
-		bool hasChild(element_type el) const;
-		// Returns a pointer to the child node which points to "el".
-		// The caller should check with hasChild(el) before calling this function.
-		sorttrie * getChild(element_type el);
-		// Walks and adds new content to the sorttrie.
-		// For simplicity we assume indexes on the same content pointer.
+		// All nodes of the trie, the root is node 0.
+		std::vector<node> arena;
+		// Stack used for the depth-first traversal: a node and how far it is visited.
+		std::vector< std::pair<size_type,int> > stack;
+		// Returns the element node n points to, cont[idx+depth].
+		const element_type& getelem(size_type n) const { return cont[arena[n].idx+arena[n].depth]; };
+		// Walks and adds suffix i to the trie, d is the depth of the children of the root.
 		void walkNadd(size_type d, size_type i);
-		// Gives the begin iterator to the children map.
-		typename std::map<element_type,sorttrie>::iterator begin();
-		typename std::map<element_type,sorttrie>::reverse_iterator rbegin();
-		// Gives the end iterator to the children map.
-		typename std::map<element_type,sorttrie>::iterator end();
-		typename std::map<element_type,sorttrie>::reverse_iterator rend();
-		// Returns the index of the Node
-		size_type getidx() const;
-		// Returns a sorted vector of indexes.
-		// build up using a depth-first search of the trie structure
-		// with getidx() on all leaves added to the return vector.
-		std::vector<size_type> getSort(sorttrie& s) const;
-		std::vector<typename V::size_type> recGS(sorttrie& s) const;
+		public:
+		// Constructor, makes an empty sorttrie on content.
+		sorttrie(const value_type& content): cont(content) {};
+		// Sorts the suffixes in [backit,frontit) which share the first startdepth elements.
+		// Returns the number of sorted suffixes, which equals the size of the range.
+		size_type sort(saiterator backit, saiterator frontit, size_type startdepth);
 		// pretty print.
 		void print(std::ostream &os);
+		private:
+		// Prints node n and its siblings at depth d, each followed by its children.
+		void print(std::ostream &os, size_type n, size_type d);
 	};
+	
+    // A unit of work for the parallel deep-shallow sort, a range [first,last) of idx.
+    // All suffixes in the range share their first shared elements.
+    // If split is set the range is a single bucket that is too large for one task, it is split
+    // into new tasks on element shared. Otherwise the range is a batch of buckets: the runs of
+    // suffixes that are equal up to depth, each is sorted with ds2 starting at depth.
+    class buckettask
+    {
+    public:
+    buckettask(): first(0), last(0), shared(0), depth(0), split(false) {};
+    buckettask(size_type f, size_type l, int s, int d, bool sp): first(f), last(l), shared(s), depth(d), split(sp) {};
+      size_type first;
+      size_type last;
+      int shared;
+      int depth;
+      bool split;
+    };
+    
+    // Runs the buckettasks of the parallel deep-shallow sort on a workstealingpool.
+    class bucketsorter
+    {
+    public:
+      bucketsorter(suffixarray<V,P>& s, workstealingpool<buckettask>& p, size_type ss);
+      ~bucketsorter();
+      // Sorts (or splits) the range of task on worker w.
+      void operator()(const buckettask& task, unsigned int w);
+    private:
+      suffixarray<V,P>& sa;
+      workstealingpool<buckettask>& pool;
+      // One sorttrie per worker.
+      std::vector<sorttrie*> tries;
+      // Buckets of at least this size are split instead of sorted by one worker.
+      size_type splitsize;
+    };
+    // Computes the lcp values in parallel for fill_lcp(), see there.
+    // Phase 1 computes the sampled plcp values of a range of samples,
+    // phase 2 the lcp values of a range of the suffixarray.
+    class lcpbuilder
+    {
+    public:
+      lcpbuilder(suffixarray<V,P>& s, std::vector<size_type>& p, unsigned int threads): sa(s), plcp(p), exceptions(threads), phase(1) {};
+      // Computes the values of the range [task.first,task.second) on worker w.
+      void operator()(const std::pair<size_type,size_type>& task, unsigned int w);
+      suffixarray<V,P>& sa;
+      // The sampled Phi values, overwritten with the sampled plcp values in phase 1.
+      std::vector<size_type>& plcp;
+      // Per worker the lcp values that do not fit in the lcp vector, stored after phase 2.
+      std::vector< std::vector< std::pair<size_type,size_type> > > exceptions;
+      int phase;
+    };
+    
+    // Reads a sorted run of suffixes back from disk during buildexternal, buffered.
+    class runreader
+    {
+    public:
+      // Opens run file f with a buffer of the given number of suffixes.
+      runreader(const std::string& f, size_type buffer);
+      // Returns the current suffix of the run.
+      size_type head() const { return buf[pos]; };
+      // Moves to the next suffix, returns false at the end of the run.
+      bool next();
+    private:
+      std::ifstream in;
+      std::vector<index_type> buf;
+      size_type pos;
+      size_type len;
+    };
+    
+    // Orders the heads of the runs while merging, smallest suffix on top of the heap.
+    // The pairs are (suffix, run).
+    class runcmp
+    {
+    public:
+      runcmp(const value_type& content): cmp(content, 0, -1) {};
+      bool operator()(const std::pair<size_type,size_type>& x, const std::pair<size_type,size_type>& y) const { return cmp(y.first, x.first); };
+    private:
+      SACmp cmp;
+    };
+    
   private:
-    // Fills the lcp vector
+    // Creates the partial suffixarray of the suffixes of s starting in [first,last),
+    // sorted with DEEPSHALLOW but without lcp and childtab values. Used by buildexternal.
+    suffixarray( const value_type& s, size_type first, size_type last, unsigned int threads);
+    
+    // Writes position i, which holds suffix sa, as one line of the file format.
+    void
+      printline(std::ostream &os, size_type i, size_type sa) const;
+    
+    // Every lcpsample-th text position has its plcp value stored while computing the lcp values.
+    static const size_type lcpsample = 16;
+    
+    // Fills the lcp vector using the given number of threads
     void 
-      fill_lcp();
+      fill_lcp(unsigned int threads = 1);
     
     // Calculates the up, down and nextl indexes in one pass.
     void
@@ -270,29 +505,182 @@ namespace ns_suffixarray {
     
     // returns the LCP value of an lcp interval.
     // this is the lcp shared by all members of the interval.
-    size_type getlcp( const interval& inter);
+    size_type getlcp( const interval& inter) const;
     
     // returns a list of all the child-intervals of the given valid LCP-interval
 		std::vector<interval>
-      getChildIntervals( const interval& parent);
+      getChildIntervals( const interval& parent) const;
+    
+    // Same, appends the child-intervals to found.
+    void
+      getChildIntervals( const interval& parent, std::vector<interval>& found) const;
     
 	// returns the larges interval.
 		interval
-		getRootInterval(){return interval(0,idx.size()-1);}
+		getRootInterval() const {return interval(0,idx.size()-1);}
+		
+    // Fills roottable with the children of the root.
+    void
+		fill_roottable();
+    
+    // Finds the child interval of the root of the suffixes starting with e in roottable,
+    // returns false if there is none. Integer elements index rootindex directly.
+    bool
+		find_rootchild( const element_type& e, interval& found) const;
+    
+    // Returns the first element of child k of the root, for rootindex.
+    class rootelement
+    {
+    public:
+      rootelement(const suffixarray<V,P>& s): sa(s) {};
+      element_type operator()(unsigned long k) const { return sa.content[(size_type) sa.idx[sa.roottable[k].i]]; };
+    private:
+      const suffixarray<V,P>& sa;
+    };
+    
+    // Finds the interval of the suffixes starting with w, which holds no wildcards, by binary
+    // search on idx (Manber and Myers), returns false if there is none.
+    bool
+		find_exact( const value_type& w, interval& found) const;
+    
+    // Returns the first row whose suffix is not smaller than w or, with upper, the first row
+    // whose suffix is larger than w and does not start with it.
+    // Only the simple min(matchlo, matchhi) skip of Manber and Myers is used, without their
+    // Llcp/Rlcp arrays, so a query of m elements takes O(m log n) comparisons in the worst
+    // case (long queries on a repetitive corpus) instead of O(m + log n).
+    size_type
+		bound( const value_type& w, bool upper) const;
+    
+    // Returns true if the elements [first,last) of w match the suffixes of inter, which
+    // share at least last elements.
+    bool
+		matches( const value_type& w, const interval& inter, size_type first, size_type last, element_type wildcard) const;
+    
+    // Returns the first row of [first,last), whose suffixes share d elements, whose element d
+    // is not smaller than e or, with upper, larger than e. A suffix without element d (the last
+    // one) counts as larger than every element.
+    size_type
+		narrow( size_type first, size_type last, size_type d, const element_type& e, bool upper) const;
+    
+    // Orders the queries of a batch (by their number) lexicographically.
+    class batchorder
+    {
+    public:
+      batchorder(const std::vector<value_type>& q): queries(q) {};
+      bool operator()(size_type a, size_type b) const { return std::lexicographical_compare(queries[a].begin(), queries[a].end(), queries[b].begin(), queries[b].end()); };
+    private:
+      const std::vector<value_type>& queries;
+    };
+    
+    // The sinks of traverse used by the queries.
+    // firstsink keeps the first interval and stops.
+    class firstsink
+    {
+    public:
+      firstsink(): found(false), first(0) {};
+      bool operator()(const interval& inter) { found = true; first = inter.i; return false; };
+      bool found;
+      size_type first;
+    };
+    
+    // countsink adds up the sizes of the intervals, it does not look at the suffix array.
+    class countsink
+    {
+    public:
+      countsink(): count(0) {};
+      bool operator()(const interval& inter) { count += inter.size(); return true; };
+      size_type count;
+    };
+    
+    // intervalsink appends the intervals to out.
+    class intervalsink
+    {
+    public:
+      intervalsink(std::vector<interval>& o): out(o) {};
+      bool operator()(const interval& inter) { out.push_back(inter); return true; };
+      std::vector<interval>& out;
+    };
+    
+    // positionsink appends the positions of the suffixes in the intervals to out.
+    class positionsink
+    {
+    public:
+      positionsink(const flatarray<index_type>& i, std::vector<size_type>& o): idx(i), out(o) {};
+      bool operator()(const interval& inter) { for(size_type j = inter.i; j <= inter.j; j++) { out.push_back(idx[j]); } return true; };
+      const flatarray<index_type>& idx;
+      std::vector<size_type>& out;
+    };
 		
+    // Views idx and tabs in the binary suffixarray at offset of m, returns false if it
+    // is not a suffixarray of content.
+    bool
+		mapbinary( const mappedfile& m, size_type offset);
+    
+    // Uses the suffix array and childtabs sections of r, which is a sectionreader or an
+    // archivereader, returns false if r is truncated or damaged or not of content.
+    template <class R>
+    bool
+		viewbinary( const R& r);
+    
+    // Returns the 8 byte magic starting the binary format.
+    static const char*
+		binarymagic() { return "SUFARRAY"; };
+    
+    // Returns a sectionwriter holding the sections of the binary format.
+    sectionwriter
+		binarywriter() const;
+    
+    // Returns the 8 byte magic starting the archive format.
+    static const char*
+		archivemagic() { return "SUFARCHV"; };
+    
     // processes a line to add to the suffix array.
     // the line should be written out earlyer by the savearray function
     void
 		processline( const std::string& line);
     
+	// Linear time sorting by induced sorting (SA-IS).
+	// Ranks the elements of the content and sorts the resulting integer sequence.
+	void
+	sais();
+	
+	// SA-IS on the integer sequence t over the alphabet [0,k).
+	// The last element of t must be a unique 0. Fills sa with the sorted suffixes of t.
+	static void
+	sais(const std::vector<size_type>& t, std::vector<size_type>& sa, size_type k);
+	
+	// Induces the order of the L-type and then the S-type suffixes from the
+	// suffixes already placed in sa (step 2 and 3 of SA-IS).
+	static void
+	induce(const std::vector<size_type>& t, const std::vector<bool>& stype, std::vector<size_type>& sa, size_type k);
+	
+	// Returns true if position i of a sequence is a leftmost S-type position.
+	static bool
+	islms(const std::vector<bool>& stype, size_type i) { return i > 0 && i < stype.size() && stype[i] && !stype[i-1]; }
+	
+	// Fills bkt with the start (end == false) or end (end == true) of each bucket of t.
+	static void
+	buckets(const std::vector<size_type>& t, std::vector<size_type>& bkt, size_type k, bool end);
+	
 	// Attemps somewhat smarter sorting
 	// fase 1 of deep-shallow sort: creates buckets.
+	// With more than one thread the buckets are sorted on a workstealingpool.
+	void
+	ds(unsigned int threads = 1);
+	
+	// Sorts the buckets found by ds() with the given number of threads.
+	// Large buckets are split on their next element, small ones are batched.
 	void
-	ds();
+	dsparallel(const std::vector< std::pair<size_type,size_type> >& buckets, unsigned int threads);
+	
+	// Returns true if the suffixes starting at x and y are equal in elements [from,to).
+	bool
+	samebucket(size_type x, size_type y, int from, int to) const;
 	
 	//fase 2 of deep-shallow sorting: sorts one bucket
+	// trie is reused between buckets, each thread needs its own.
 	void
-		ds2( typename std::vector<size_type>::iterator backit,  typename std::vector<size_type>::iterator frontit,int startdepth);
+		ds2( saiterator backit,  saiterator frontit,int startdepth, sorttrie& trie);
 
     // Points to the sequence on wich the suffix array is build
     const value_type& content;
@@ -301,20 +689,100 @@ namespace ns_suffixarray {
     childtabs tabs;
     
     // Points to the index array, The regular suffix array.
-		std::vector<size_type> idx;
+		flatarray<index_type> idx;
+    
+    // The file idx and tabs are viewed in, if the suffixarray was loaded from a binary file.
+    mappedfile mapping;
+    
+    // The child intervals of the root, one per distinct first element in suffix array order,
+    // so queries starting with a wildcard or followed by one do not walk the root's children.
+    std::vector<interval> roottable;
+    
+    // Finds the child of the root in roottable by its first element.
+    rootdirectory<element_type> rootindex;
+    
+    // Statistics of the construction and the queries.
+    mutable buildstats stats;
     
 public:
   // suffixarray creates a suffixarray based on s.
-  suffixarray( const value_type& s);
+  // method selects the algorithm used to sort the suffixes, both give the same index.
+  // threads is the number of threads used to compute the lcp values and,
+  // with DEEPSHALLOW, to sort the buckets.
+  suffixarray( const value_type& s, sortmethod method = DEEPSHALLOW, unsigned int threads = 1);
 
   // suffixarray reads in a suffixarray from a file.
   // the value_type should be equal to the datastructure the suffixarray was created on the first time.
+  // Files written by savebinary are mapped into memory and used in place, files written
+  // by savesarray are parsed.
 		suffixarray( const value_type& s, const std::string& f);
 
+  // suffixarray uses the binary suffixarray at byte offset of the mapped file m in place,
+  // as written by writebinary. The mapping is kept as long as the suffixarray needs it.
+  // If the data does not hold a suffixarray of s the suffixarray is left empty (size() is 0).
+		suffixarray( const value_type& s, const mappedfile& m, size_type offset = 0);
+
+  // suffixarray decodes the archive read by a (see openarchive), on the threads of a.
+  // If the archive does not hold a suffixarray of s the suffixarray is left empty.
+		suffixarray( const value_type& s, const archivereader& a);
+
   // Stores the suffixarray in file f, returns false on failure.
   bool
     savesarray( const std::string& f);
 
+  // Stores the suffixarray in file f in the binary format, returns false on failure.
+  bool
+    savebinary( const std::string& f) const;
+
+  // Writes the suffixarray in the binary format on os, returns false on failure.
+  // The sections are aligned relative to the start of the data, so when embedding it
+  // in a larger file start it at a multiple of sectionwriter::sectionalign.
+  bool
+    writebinary( std::ostream& os) const;
+
+  // Returns the number of bytes writebinary writes.
+  size_type
+    binarysize() const { return binarywriter().size(); };
+
+  // Returns true if file f starts like a file written by savebinary.
+  static bool
+    isbinary( const std::string& f);
+
+  // The version of the binary format written by writebinary.
+  static const unsigned int binaryversion = 3;
+
+  // Stores the suffixarray in file f in the compressed archive format, returns false on failure.
+  // The arrays are compressed in blocks of blocksize elements that are decoded independently.
+  bool
+    savearchive( const std::string& f, size_type blocksize = 65536) const;
+
+  // Writes the suffixarray in the archive format on os, returns false on failure.
+  bool
+    writearchive( std::ostream& os, size_type blocksize = 65536) const;
+
+  // Returns true if file f starts like a file written by savearchive.
+  static bool
+    isarchive( const std::string& f);
+
+  // Reads the directory of the archive at offset of m, whose blocks are then decoded on
+  // demand, or all at once on the given number of threads by suffixarray(s, a).
+  static archivereader
+    openarchive( const mappedfile& m, size_type offset = 0, unsigned int threads = 1);
+
+  // The version of the archive format written by writearchive.
+  static const unsigned int archiveversion = 1;
+
+  // buildexternal builds the suffixarray of s and stores it in file f, as savebinary
+  // would, for corpora whose index does not fit in memory. The suffixes are sorted in
+  // partitions that fit in membudget bytes, which are written to tmpdir and merged.
+  // Only the lcp and childtab values (with the default storagepolicy 2 bytes per element
+  // plus exceptions), one plcp sample per 16 elements and the content are kept in memory
+  // besides the budget. Load the result with the loading constructor.
+  // threads is the number of threads used to sort a partition.
+  // Returns false if a file could not be written.
+  static bool
+    buildexternal( const value_type& s, const std::string& f, size_type membudget, const std::string& tmpdir = ".", unsigned int threads = 1);
+
   // find_position returns a position if w is present in the
   // suffixarray and otherwise it raises a StringNotFound exception. w need
   // not be a suffix.  wildcard indicates which element_type should be
@@ -323,6 +791,10 @@ public:
   size_type
   find_position( const value_type& w, element_type wildcard = element_type()) const;
 
+  // Same, using the buffers of context.
+  size_type
+  find_position( const value_type& w, querycontext& context, element_type wildcard = element_type()) const;
+
   // find_all_positions finds all positions of substring w occurring
   // in the suffix tree. The vector need not be ordered.  wildcard
   // indicates which element_type should be considered the wildcard
@@ -330,12 +802,68 @@ public:
 		std::vector<size_type>
   find_all_positions( const value_type& w, element_type wildcard = element_type()) const;
 
+  // Same, stores the positions in results (which is cleared first) using the buffers of context.
+  void
+  find_all_positions( const value_type& w, std::vector<size_type>& results, querycontext& context, element_type wildcard = element_type()) const;
+
+  // find_intervals returns the intervals of the suffixarray holding the suffixes that start with w.
+  // Without wildcards this is at most one interval, wildcards may split it up in several ones.
+  // wildcard indicates which element_type should be considered the wildcard element.
+		std::vector<interval>
+  find_intervals( const value_type& w, element_type wildcard = element_type()) const;
+
+  // Same, the intervals are kept in context until its next query.
+  const std::vector<interval>&
+  find_intervals( const value_type& w, querycontext& context, element_type wildcard = element_type()) const;
+
+  // getposition returns the position in the content of the i-th suffix of the suffixarray.
+  size_type
+  getposition( size_type i) const { return idx[i]; };
+
+  // size returns the number of suffixes, the length of the content.
+  size_type
+  size() const { return idx.size(); };
+
+  // getstats returns the time and memory used per construction phase, the bucket sizes,
+  // the sizes of the exception maps and the number of queries answered.
+  const buildstats&
+  getstats() const { return stats; };
+
+  // countqueries turns counting the queries in getstats() on or off, it is off by default
+  // because all querying threads would update the same counters.
+  void
+  countqueries(bool on) const { stats.countqueries(on); };
+
   // find_all_positions_count finds the number of positions of
   // substring w occurring in the suffix tree.  wildcard indicates
   // which element_type should be considered the wildcard element.
   // Wildcards match any one element_type.
   size_type
-  find_all_positions_count( const value_type& w, element_type wildcard = element_type());
+  find_all_positions_count( const value_type& w, element_type wildcard = element_type()) const;
+
+  // Same, using the buffers of context.
+  size_type
+  find_all_positions_count( const value_type& w, querycontext& context, element_type wildcard = element_type()) const;
+
+  // find_all_positions_count_batch returns the number of occurrences of every query in w, in the
+  // order of w. The queries without wildcards are sorted, so queries sharing a prefix search for
+  // it once: a batch of continuations of one context costs about one search plus a binary search
+  // per continuation. Queries with wildcards are answered one by one.
+  std::vector<size_type>
+  find_all_positions_count_batch( const std::vector<value_type>& w, element_type wildcard = element_type()) const;
+
+  // Same, stores the counts in counts using the buffers of context.
+  void
+  find_all_positions_count_batch( const std::vector<value_type>& w, std::vector<size_type>& counts, querycontext& context, element_type wildcard = element_type()) const;
+
+  // traverse calls sink(inter) for every interval inter of the suffixarray holding suffixes that
+  // start with w, in suffix array order, until sink returns false. The lcp-interval tree is
+  // searched depth first, so a sink that stops early saves the rest of the search.
+  // The queries above are traverse with a sink that keeps the first interval, counts,
+  // or collects intervals or positions.
+  template <class S>
+  void
+  traverse( const value_type& w, S& sink, querycontext& context, element_type wildcard = element_type()) const;
 
   // find_all_positions_skip finds all positions of the skipgram and returns those list of positions.
   // each position is an index on the content of the suffixarray. points at the first element of the skipgram.
@@ -353,12 +881,24 @@ public:
   // within each part of the skipgram it is explicitly allowed to use wildcards.
   size_type
 		find_all_positions_skip_count( const std::vector<value_type>& w, size_type minskip, size_type maxskip, element_type wildcard = element_type()) const;
+
+  // join_skip_positions returns the positions of the skipgrams made of the parts whose
+  // (sorted) positions are given in idx, with the same skip constraints as find_all_positions_skip.
+  static std::vector< size_type >
+		join_skip_positions( std::vector< std::vector<size_type> >& idx, size_type minskip, size_type maxskip);
   
 
 		// print the lcp-interval tree
 		// debug purposes
 		void printlcpintervaltree();
 		
+  // useroottable builds (the default) or drops the table of the child intervals of the root,
+  // which takes two size_types per distinct element, and for integer elements (such as the
+  // tokens of an internedsuffixarray) one more per value between the smallest and largest. Without it every query with a wildcard
+  // lists all children of the root. Not to be called while queries run.
+  void
+		useroottable( bool use);
+		
   // print writes the suffixarray on os.
   void
 		print(std::ostream &os);
@@ -381,454 +921,710 @@ public:
 };
 
 	//
-	// suffixarray::SACmp public functions:
+	// elementranks functions:
 	//
 	
-	template <class V>
-	bool 
-	suffixarray<V>::SACmp::operator()(size_type x, size_type y) const
-	{   
-		if(x == y)
-		{
-			return false;
-		}
-		if(x + min > cont.size()){return false;}
-		if(y + min > cont.size()){return false;}
-		typename V::const_iterator itx = cont.begin() + min + x;
-		typename V::const_iterator ity = cont.begin() + min + y;
-		int m = max;
-		while(--m != 0)
+	template <class E, bool integer>
+	template <class V, class S>
+	S
+	elementranks<E,integer>::rank(const V& content, std::vector<S>& t)
+	{
+		std::vector<E> alphabet(content.begin(), content.end());
+		sort(alphabet.begin(), alphabet.end());
+		alphabet.erase(unique(alphabet.begin(), alphabet.end()), alphabet.end());
+		t.resize(content.size()+1);
+		for(S i = 0; i < (S) content.size(); i++)
 		{
-			if(*itx == *ity){++itx;++ity;}
-			else { return *itx < *ity; }
+			t[i] = (S) (lower_bound(alphabet.begin(), alphabet.end(), content[i]) - alphabet.begin()) + 1;
 		}
-		return *itx < *ity;
+		t[content.size()] = 0;
+		return (S) alphabet.size() + 1;
 	}
 	
-	
 	//
-	// suffixarray::childtabs private functions:
+	// rootdirectory functions:
 	//
 	
-	template <class V>
-	void
-	suffixarray<V>::childtabs::store(std::vector<signed char>& vec, std::map<size_type,size_type>& map,size_type pos, size_type value)
+	template <class E, bool integer>
+	template <class F>
+	unsigned long
+	rootdirectory<E,integer>::search(const F& first, unsigned long lo, unsigned long hi, const E& e)
 	{
-		// signed char is -128 to 127 exception positions are -128 (NO assignment, (value_type) -1) and 127 (lookup in map)
-		int rel = value - pos;
-		if(rel < (int) 127 && rel > (int) -128 )
+		unsigned long end = hi;
+		while(lo < hi)
 		{
-			vec.at(pos) = (signed char) rel;
-			return;
+			unsigned long mid = lo + (hi - lo) / 2;
+			if(first(mid) < e)
+			{
+				lo = mid + 1;
+			}
+			else
+			{
+				hi = mid;
+			}
 		}
-		vec.at(pos) = (signed char) 127;
-		map.insert ( std::pair<size_type,size_type>(pos,value) );									
+		return lo < end && first(lo) == e ? lo : end;
 	}
 	
-	template <class V>
-	typename V::size_type
-	suffixarray<V>::childtabs::retrieve(std::vector<signed char>& vec, std::map<size_type,size_type>& map,size_type pos)
+	template <class E>
+	template <class F>
+	void
+	rootdirectory<E,true>::build(const F& first, unsigned long n)
 	{
-		// signed char is -128 to 127 exception positions are -128 (NO assignment, (value_type) -1) and 127 (lookup in map)
-		if(pos > vec.size() || pos < (size_type) 0 || pos == (size_type) -1)
+		clear();
+		if(n == 0)
 		{
-			return (size_type) -1;
+			return;
 		}
-		signed char out = vec.at(pos);
-		if((int) out == (int) -128)
+		base = first(0);
+		// At most 4 slots per child (plus a few), so the table stays near the size of roottable.
+		unsigned long c = n;
+		while(c > 0 && (unsigned long) ((long) first(c-1) - (long) base) + 1 > 4 * c + 256)
 		{
-			return (size_type) -1;
+			c--;
+		}
+		if(c == 0)
+		{
+			return;
 		}
-		if((int) out == (int) 127)
+		slots.assign((unsigned long) ((long) first(c-1) - (long) base) + 1, (unsigned long) -1);
+		for(unsigned long k = 0; k < c; k++)
 		{
-			return map.find(pos)->second;
+			slots[(unsigned long) ((long) first(k) - (long) base)] = k;
 		}
-		return (size_type) ((int) pos + (int) out);
+		covered = c;
 	}
 	
-	template <class V>
-	bool
-	suffixarray<V>::childtabs::isnextl(size_type pos) const
+	template <class E>
+	template <class F>
+	unsigned long
+	rootdirectory<E,true>::find(const F& first, unsigned long n, const E& e) const
 	{
-		// if lcptab[childtab[i].nextlindex] = lcptab[i]
-		size_type lcpi = getlcp(pos);
-		size_type nextli = retrieve(pos);
-		size_type lcpii = getlcp(nextli);
-		//cerr << "\nSARR.DEBUG isnextl pos: " << pos << endl;
-		//cerr << "\tlcpi: " << lcpi <<" nextli: " << nextli << " lcpii: " << lcpii << endl;
-		if(pos == nextli)
+		if(e < base)
 		{
-			return false;
+			return n;
 		}
-		if(lcpi == lcpii)
+		unsigned long s = (unsigned long) ((long) e - (long) base);
+		if(s < slots.size())
 		{
-			return true;
+			return slots[s] == (unsigned long) -1 ? n : slots[s];
 		}
-		return false;
+		return rootdirectory<E,false>::search(first, covered, n, e);
 	}
 	
-	template <class V>
-	bool
-	suffixarray<V>::childtabs::isup(size_type pos) const
+	template <class E>
+	template <class V, class S>
+	S
+	elementranks<E,true>::rank(const V& content, std::vector<S>& t)
 	{
-		if(pos == 0)
+		if(content.size() == 0)
 		{
-			return false;
+			t.assign(1, 0);
+			return 1;
 		}
-		return getlcp(pos-1) > getlcp(pos);
-	}
-	
-	template <class V>
-	bool
-	suffixarray<V>::childtabs::isdownl(size_type pos) const
-	{
-		// if lcptab[childtab[i].nextlindex] > lcptab[i]
-		size_type nextli = retrieve(pos);
-		size_type lcpi = getlcp(nextli);
-		size_type lcpii = getlcp(pos);
-		if(pos == nextli)
+		E min = *std::min_element(content.begin(), content.end());
+		E max = *std::max_element(content.begin(), content.end());
+		unsigned long range = (unsigned long) ((long) max - (long) min) + 1;
+		if(range > (unsigned long) content.size())
+		{ // Sparse values, counting would cost more than sorting.
+			return elementranks<E,false>::rank(content, t);
+		}
+		std::vector<S> ranks(range, 0);
+		for(S i = 0; i < (S) content.size(); i++)
 		{
-			return false;
+			ranks[(unsigned long) ((long) content[i] - (long) min)] = 1;
 		}
-		if(lcpi > lcpii)
+		S k = 0;
+		for(unsigned long r = 0; r < range; r++)
 		{
-			return true;
+			if(ranks[r] != 0)
+			{
+				ranks[r] = ++k;
+			}
 		}
-		return false;
+		t.resize(content.size()+1);
+		for(S i = 0; i < (S) content.size(); i++)
+		{
+			t[i] = ranks[(unsigned long) ((long) content[i] - (long) min)];
+		}
+		t[content.size()] = 0;
+		return k + 1;
 	}
 	
-	template <class V>
-	bool
-	suffixarray<V>::childtabs::isdownu(size_type pos) const
-	{
-		return isnextl(pos);
+	//
+	// suffixarray::SACmp public functions:
+	//
+	
+	template <class V, class P>
+	bool 
+	suffixarray<V,P>::SACmp::operator()(size_type x, size_type y) const
+	{   
+		if(x == y)
+		{
+			return false;
+		}
+		if(x + min > cont.size()){return false;}
+		if(y + min > cont.size()){return false;}
+		typename V::const_iterator itx = cont.begin() + min + x;
+		typename V::const_iterator ity = cont.begin() + min + y;
+		int m = max;
+		while(--m != 0)
+		{
+			if(*itx == *ity){++itx;++ity;}
+			else { return *itx < *ity; }
+		}
+		return *itx < *ity;
 	}
 	
+	
 	//
-	// suffixarray::childtabs public functions:
+	// suffixarray::bucketsorter public functions:
 	//
 	
-	template <class V>
-	void
-	suffixarray<V>::childtabs::init_tabs(size_type size)
+	template <class V, class P>
+	suffixarray<V,P>::bucketsorter::bucketsorter(suffixarray<V,P>& s, workstealingpool<buckettask>& p, size_type ss): sa(s), pool(p), splitsize(ss)
 	{
-		lcp = std::vector<unsigned char>(size);
-		lcpmap = std::map<size_type,size_type>();
-		
-		//all = std::vector<signed char>(size,-128);
-		//allmap = std::map<size_type,size_type>();
-		
-		up = std::vector<signed char>(size,-128);
-		down = std::vector<signed char>(size,-128);
-		nextl = std::vector<signed char>(size,-128);
-		
-		upmap = std::map<size_type,size_type>();
-		downmap = std::map<size_type,size_type>();
-		nextlmap = std::map<size_type,size_type>();
-
+		for(unsigned int w = 0; w < pool.size(); w++)
+		{
+			tries.push_back(new sorttrie(sa.content));
+		}
 	}
 	
-	template <class V>
-	void
-	suffixarray<V>::childtabs::setlcp(size_type pos, size_type value)
+	template <class V, class P>
+	suffixarray<V,P>::bucketsorter::~bucketsorter()
 	{
-		if(pos >= lcp.size())
+		for(unsigned int w = 0; w < tries.size(); w++)
 		{
-			std::cerr << "ERROR ERROR :: POS IS TOT LARGE:: " << pos << std::endl;
-			exit(0);
+			delete tries[w];
 		}
-		// unsigned char is [0,255] 255 stores exceptions
-		if(value < (size_type) 255)
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::bucketsorter::operator()(const buckettask& task, unsigned int w)
+	{
+		saiterator base = sa.idx.begin();
+		if(!task.split)
 		{
-			lcp.at(pos) = (unsigned char) value;
+			// Find the buckets in the batch and sort them one by one.
+			size_type back = task.first;
+			for(size_type front = task.first+1; front <= task.last; front++)
+			{
+				if(front == task.last || !sa.samebucket(sa.idx[back], sa.idx[front], task.shared, task.depth))
+				{
+					if(front - back > 1)
+					{
+						sa.ds2(base+back, base+front, task.depth, *tries[w]);
+					}
+					back = front;
+				}
+			}
 			return;
 		}
-		lcp.at(pos) = (unsigned char) 255;
-		lcpmap.insert ( std::pair<size_type,size_type>(pos,value) );
+		// Split the bucket on the next element, the parts are new tasks.
+		// Large parts are split again, small neighbouring parts are batched.
+		std::sort(base+task.first, base+task.last, SACmp(sa.content, task.shared, 1));
+		size_type batch = task.first;
+		size_type back = task.first;
+		for(size_type front = task.first+1; front <= task.last; front++)
+		{
+			if(front == task.last || !sa.samebucket(sa.idx[back], sa.idx[front], task.shared, task.shared+1))
+			{
+				if(front - back >= splitsize)
+				{
+					if(back > batch)
+					{
+						pool.push(w, buckettask(batch, back, task.shared, task.shared+1, false));
+					}
+					pool.push(w, buckettask(back, front, task.shared+1, task.shared+1, true));
+					batch = front;
+				}
+				else if(front - batch >= splitsize / 4)
+				{
+					pool.push(w, buckettask(batch, front, task.shared, task.shared+1, false));
+					batch = front;
+				}
+				back = front;
+			}
+		}
+		if(task.last > batch)
+		{
+			pool.push(w, buckettask(batch, task.last, task.shared, task.shared+1, false));
+		}
 	}
 	
-	template <class V>
-	typename V::size_type
-	suffixarray<V>::childtabs::getlcp(size_type pos)
+	//
+	// suffixarray::lcpbuilder public functions:
+	//
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::lcpbuilder::operator()(const std::pair<size_type,size_type>& task, unsigned int w)
 	{
-		// unsigned char is [0,255] 255 stores exceptions
-		if(pos > lcp.size() || pos < 0 || pos == (size_type) -1)
+		const size_type none = (size_type) -1;
+		const value_type& content = sa.content;
+		// The content ends with a unique element, so two different suffixes always differ
+		// before either runs off the end and the loops below need no bounds checks.
+		if(phase == 1)
 		{
-			return (size_type) -1;
+			// plcp[j+q] >= plcp[j] - q, carry h over the samples in this block.
+			size_type h = 0;
+			for(size_type s = task.first; s < task.second; s++)
+			{
+				size_type j = s * lcpsample;
+				size_type k = plcp[s];
+				if(k == none)
+				{ // The smallest suffix has no predecessor.
+					plcp[s] = 0;
+					h = 0;
+					continue;
+				}
+				while(content[j+h] == content[k+h])
+				{
+					h++;
+				}
+				plcp[s] = h;
+				h = h > lcpsample ? h - lcpsample : 0;
+			}
+			return;
 		}
-		unsigned char out = lcp.at(pos);
-		if((size_type) out < 255)
+		for(size_type i = task.first; i < task.second; i++)
 		{
-			return (size_type) out;
+			if(i == 0)
+			{
+				continue;
+			}
+			size_type j = sa.idx[i];
+			size_type k = sa.idx[i-1];
+			size_type skip = j % lcpsample;
+			size_type h = plcp[j / lcpsample];
+			h = h > skip ? h - skip : 0;
+			while(content[j+h] == content[k+h])
+			{
+				h++;
+			}
+			if(h < childtabs::lcpescape())
+			{ // Only touches lcp[i], safe to do in parallel.
+				sa.tabs.setlcp(i, h);
+			}
+			else
+			{ // Would insert into the exception map, stored after all threads are done.
+				exceptions[w].push_back(std::pair<size_type,size_type>(i, h));
+			}
 		}
-		return lcpmap.find(pos)->second;
 	}
 	
-	template <class V>
-	void
-	suffixarray<V>::childtabs::setnextl(size_type pos, size_type value)
+	//
+	// suffixarray::runreader public functions:
+	//
+	
+	template <class V, class P>
+	suffixarray<V,P>::runreader::runreader(const std::string& f, size_type buffer): in(f.c_str(), std::ios::in | std::ios::binary), buf(buffer), pos(0), len(0)
 	{
-		store(nextl,nextlmap,pos, value);
 	}
 	
-	template <class V>
-	typename V::size_type
-	suffixarray<V>::childtabs::getnextl(size_type pos)
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::runreader::next()
 	{
-		//if(isnextl(pos))
-		//{
-			return retrieve(nextl,nextlmap,pos);
-		//}
-		//return (size_type) -1;
+		if(pos + 1 < len)
+		{
+			++pos;
+			return true;
+		}
+		in.read((char*) &buf[0], buf.size() * sizeof(index_type));
+		len = in.gcount() / sizeof(index_type);
+		pos = 0;
+		return len > 0;
 	}
 	
-	template <class V>
+	//
+	// suffixarray::childtabs private functions:
+	//
+	
+	template <class V, class P>
 	void
-	suffixarray<V>::childtabs::setup(size_type pos, size_type value)
+	suffixarray<V,P>::childtabs::store(size_type pos, size_type value)
 	{
-		//if(isup(pos))
-		//{
-		//	--pos;
-			store(up,upmap,pos, value);
-		//}
+		// for signed char exception positions are -128 (NO assignment, (value_type) -1) and 127 (lookup in map)
+		long rel = (long) value - (long) pos;
+		if(rel < childescape() && rel > childnone())
+		{
+			child.at(pos) = (child_type) rel;
+			return;
+		}
+		child.at(pos) = (child_type) childescape();
+		childmap.set(pos, value);
 	}
 	
-	template <class V>
+	template <class V, class P>
 	typename V::size_type
-	suffixarray<V>::childtabs::getup(size_type pos)
+	suffixarray<V,P>::childtabs::retrieve(size_type pos) const
 	{
-		/*if(pos >= lcp.size() 
-		   or pos < 1
-		   or not isup(pos))
+		// for signed char exception positions are -128 (NO assignment, (value_type) -1) and 127 (lookup in map)
+		if(pos >= child.size())
+		{
+			return (size_type) -1;
+		}
+		long out = child[pos];
+		if(out == childnone())
 		{
 			return (size_type) -1;
 		}
-		--pos;*/
-		return retrieve(up,upmap,pos);
+		if(out == childescape())
+		{
+			return childmap.get(pos);
+		}
+		return (size_type) ((long) pos + out);
 	}
 	
-	template <class V>
-	void
-	suffixarray<V>::childtabs::setdown(size_type pos, size_type value)
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::childtabs::isup(size_type pos) const
 	{
-		//if(isdownl(pos));
-		//{
-			store(down, downmap,pos,value);
-		//}
+		if(pos == 0 || pos >= lcp.size())
+		{
+			return false;
+		}
+		return getlcp(pos-1) > getlcp(pos);
 	}
 	
-	template <class V>
-	typename V::size_type
-	suffixarray<V>::childtabs::getdown(size_type pos)
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::childtabs::isnextl(size_type pos, size_type value) const
 	{
-		//if(isdownl(pos))
-		//{
-			return retrieve(down, downmap, pos);
-		/*}
-		if(isdownu(pos))
-		{
-			if(pos == 0)
-			{
-				return getup(pos+2)+1;
-			}
-			return getup(pos+2);
-		}
-		return (size_type) -1;*/
+		// if lcptab[childtab[i].nextlindex] = lcptab[i], a down value has a larger lcp
+		return value != pos && getlcp(value) == getlcp(pos);
 	}
 	
 	//
-	// suffixarray::sorttrie public functions
+	// suffixarray::childtabs public functions:
 	//
-	template <class V>
-	suffixarray<V>::sorttrie::sorttrie(const value_type& content, size_type d, size_type i): cont(content)
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::childtabs::countexceptions(buildstats& stats) const
 	{
-		depth = d;
-		idx = i;
+		stats.setexceptions("lcp", lcpmap.size());
+		stats.setexceptions("child", childmap.size());
 	}
 	
-	template <class V>
+	template <class V, class P>
 	void
-	suffixarray<V>::sorttrie::makeChildSelf()
+	suffixarray<V,P>::childtabs::freeze()
 	{
-		addChild(sorttrie( cont, depth+1, idx ));
+		lcpmap.freeze(escaped<lcp_type,size_type>(lcp, lcpescape()));
+		childmap.freeze(escaped<child_type,long>(child, childescape()));
 	}
 	
-	template <class V>
+	template <class V, class P>
+	template <class W>
 	void
-	suffixarray<V>::sorttrie::addChild(sorttrie child)
+	suffixarray<V,P>::childtabs::addsections(W& w) const
 	{
-		children.insert(std::pair<element_type,sorttrie>(child.getelem(),child));
+		w.add(lcp);
+		w.add(lcpmap.getpositions().getbits());
+		w.add(lcpmap.getpositions().getranks());
+		w.add(lcpmap.getvalues());
+		w.add(child);
+		w.add(childmap.getpositions().getbits());
+		w.add(childmap.getpositions().getranks());
+		w.add(childmap.getvalues());
 	}
 	
-	template <class V>
-	typename V::value_type
-	suffixarray<V>::sorttrie::getelem() const
+	template <class V, class P>
+	template <class R>
+	bool
+	suffixarray<V,P>::childtabs::viewsections(const R& r, typename R::offset_type first, size_type size)
 	{
-		if(depth >= 0)
+		exceptiontable<size_type>* maps[] = { &lcpmap, &childmap };
+		for(unsigned int m = 0; m < 2; m++)
 		{
-			return cont.at(idx+depth);
+			typename R::offset_type at = first + 4*m;
+			bool ok = m == 0 ? r.view(at, lcp) : r.view(at, child);
+			flatarray<uint64_t> bits;
+			flatarray<size_type> ranks, values;
+			bitvector positions;
+			ok = ok && r.view(at + 1, bits) && r.view(at + 2, ranks) && r.view(at + 3, values);
+			ok = ok && positions.assign(bits, ranks) && maps[m]->assign(positions, values);
+			if(!ok || (m == 0 ? lcp.size() : child.size()) != size)
+			{
+				return false;
+			}
 		}
-		// Note: can only occur on the root of the tree
-		// And only when the print function is called (normally one only looks at the children)
-		// And only with a starting depth of -1 (or 0) depends on how you look at it
-		// value is undefined so we return the default value for the type.
-		element_type a;
-		return a;
+		return true;
 	}
 	
-	template <class V>
-	bool
-	suffixarray<V>::sorttrie::hasChild(element_type el) const
+	template <class V, class P>
+	void
+	suffixarray<V,P>::childtabs::init_tabs(size_type size)
 	{
-		return(children.find(el) != children.end());
+		lcp.assign(size, 0);
+		lcpmap = exceptiontable<size_type>();
+		
+		child.assign(size, (child_type) childnone());
+		childmap = exceptiontable<size_type>();
 	}
 	
-	template <class V>
-	typename suffixarray<V>::sorttrie *
-	suffixarray<V>::sorttrie::getChild(element_type el)
+	template <class V, class P>
+	void
+	suffixarray<V,P>::childtabs::setlcp(size_type pos, size_type value)
 	{
-		sorttrie * uit = &(children.find(el)->second);
-		return uit;
+		if(pos >= lcp.size())
+		{
+			std::cerr << "ERROR ERROR :: POS IS TOT LARGE:: " << pos << std::endl;
+			exit(0);
+		}
+		// for unsigned char [0,255] 255 stores exceptions
+		if(value < lcpescape())
+		{
+			lcp.at(pos) = (lcp_type) value;
+			return;
+		}
+		lcp.at(pos) = (lcp_type) lcpescape();
+		lcpmap.set(pos, value);
 	}
 	
-	template <class V>
-	void
-	suffixarray<V>::sorttrie::walkNadd(size_type d, size_type i)
+	template <class V, class P>
+	typename V::size_type
+	suffixarray<V,P>::childtabs::getlcp(size_type pos) const
 	{
-		sorttrie *s = this;
-		while(1)
+		// for unsigned char [0,255] 255 stores exceptions
+		if(pos >= lcp.size())
 		{
-			if(s->isLeaf()){s->makeChildSelf();}
-			element_type el = cont[i+d];
-			if(s->hasChild(el))
-			{
-				s = s->getChild(el);
-				++d;
-			}
-			else
-			{
-				s->addChild(sorttrie( cont, d, i ));
-				return;
-			}
+			return (size_type) -1;
+		}
+		size_type out = lcp[pos];
+		if(out < lcpescape())
+		{
+			return (size_type) out;
 		}
+		return lcpmap.get(pos);
 	}
 	
-	template <class V>
-	typename std::map<typename V::value_type,typename suffixarray<V>::sorttrie>::iterator
-	suffixarray<V>::sorttrie::begin()
+	template <class V, class P>
+	void
+	suffixarray<V,P>::childtabs::setnextl(size_type pos, size_type value)
 	{
-		return children.begin();
+		// nextl takes the place of down.
+		store(pos, value);
 	}
 	
-	template <class V>
-	typename std::map<typename V::value_type,typename suffixarray<V>::sorttrie>::reverse_iterator
-	suffixarray<V>::sorttrie::rbegin()
+	template <class V, class P>
+	typename V::size_type
+	suffixarray<V,P>::childtabs::getnextl(size_type pos) const
 	{
-		return children.rbegin();
+		if(isup(pos+1))
+		{
+			return (size_type) -1;
+		}
+		size_type value = retrieve(pos);
+		if(value == (size_type) -1 || !isnextl(pos, value))
+		{
+			return (size_type) -1;
+		}
+		return value;
 	}
 	
-	
-	template <class V>
-	typename std::map<typename V::value_type,typename suffixarray<V>::sorttrie>::iterator
-	suffixarray<V>::sorttrie::end()
+	template <class V, class P>
+	void
+	suffixarray<V,P>::childtabs::setup(size_type pos, size_type value)
 	{
-		return children.end();
+		// stored on pos-1, whose nextl and down values are undefined.
+		if(pos > 0)
+		{
+			store(pos-1, value);
+		}
 	}
 	
-	template <class V>
-	typename std::map<typename V::value_type,typename suffixarray<V>::sorttrie>::reverse_iterator
-	suffixarray<V>::sorttrie::rend()
+	template <class V, class P>
+	typename V::size_type
+	suffixarray<V,P>::childtabs::getup(size_type pos) const
 	{
-		return children.rend();
+		if(!isup(pos))
+		{
+			return (size_type) -1;
+		}
+		return retrieve(pos-1);
 	}
 	
-	
-	template <class V>
-	typename V::size_type
-	suffixarray<V>::sorttrie::getidx() const
+	template <class V, class P>
+	void
+	suffixarray<V,P>::childtabs::setdown(size_type pos, size_type value)
 	{
-		return idx;
+		size_type old = retrieve(pos);
+		if(old == (size_type) -1 || !isnextl(pos, old))
+		{
+			store(pos, value);
+		}
 	}
-	template <class V>
-	std::vector<typename V::size_type> 
-	suffixarray<V>::sorttrie::recGS(sorttrie& s) const
+	
+	template <class V, class P>
+	typename V::size_type
+	suffixarray<V,P>::childtabs::getdown(size_type pos) const
 	{
-		std::vector<typename V::size_type> uit;
-		if(s.isLeaf())
+		if(isup(pos+1))
 		{
-			uit.push_back(s.getidx());
+			return (size_type) -1;
 		}
-		else
+		size_type value = retrieve(pos);
+		if(value == (size_type) -1 || isnextl(pos, value))
+		{
+			return (size_type) -1;
+		}
+		return value;
+	}
+	
+	//
+	// suffixarray::sorttrie functions
+	//
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::sorttrie::walkNadd(size_type d, size_type i)
+	{
+		size_type s = 0;
+		while(1)
 		{
-			typename std::map<element_type,sorttrie>::iterator it = s.begin();
-			while(it != s.end())
+			if(arena[s].eq == none)
+			{ // A leaf: move its own suffix one level down so it gets siblings.
+				size_type child = arena.size();
+				arena.push_back(node(arena[s].idx, arena[s].depth+1));
+				arena[s].eq = child;
+			}
+			const element_type& el = cont[i+d];
+			// Search the children of s for el.
+			size_type parent = s;
+			size_type c = arena[s].eq;
+			int dir = 0;
+			while(c != none)
 			{
-				std::vector<typename V::size_type>temp = recGS((*it).second);
-				typename std::vector<typename V::size_type>::iterator itt = temp.begin();
-				while(itt != temp.end())
+				const element_type& curr = getelem(c);
+				if(el < curr)
 				{
-					uit.push_back(*itt);
-					++itt;
+					parent = c;
+					dir = -1;
+					c = arena[c].lo;
 				}
-				++it;
+				else if(curr < el)
+				{
+					parent = c;
+					dir = 1;
+					c = arena[c].hi;
+				}
+				else
+				{
+					break;
+				}
+			}
+			if(c != none)
+			{
+				s = c;
+				++d;
+			}
+			else
+			{
+				size_type child = arena.size();
+				arena.push_back(node(i, d));
+				if(dir < 0)
+				{
+					arena[parent].lo = child;
+				}
+				else
+				{
+					arena[parent].hi = child;
+				}
+				return;
 			}
 		}
-		return uit;
 	}
 	
-	template <class V>
-	std::vector<typename V::size_type>
-	suffixarray<V>::sorttrie::getSort(sorttrie& strie) const
+	template <class V, class P>
+	typename V::size_type
+	suffixarray<V,P>::sorttrie::sort(saiterator backit, saiterator frontit, size_type startdepth)
 	{
-		std::vector<typename V::size_type> uit;
-		//uit = recGS(strie);
-		//return uit;
-		std::stack<sorttrie*> s;
-		s.push(&strie);
-		while(s.size() > 0)
+		// build the trie
+		arena.clear();
+		saiterator it = backit;
+		arena.push_back(node(*it, startdepth-1));
+		++it;
+		while(it != frontit)
 		{
-			sorttrie * curr = s.top();
-			s.pop();
-			if(curr->isLeaf())
+			walkNadd(startdepth, *it);
+			++it;
+		}
+		// depth-first traversal of the trie, writing the leaves back in order.
+		// Per node: 0 visit the smaller siblings, 1 the node itself, 2 the larger siblings.
+		it = backit;
+		stack.clear();
+		stack.push_back(std::pair<size_type,int>(arena[0].eq, 0));
+		while(stack.size() > 0)
+		{
+			std::pair<size_type,int>& curr = stack.back();
+			size_type n = curr.first;
+			if(n == none)
 			{
-				//std::cerr << "FOUND LEAF " << std::endl;
-				uit.push_back(curr->getidx());
+				stack.pop_back();
 			}
-			else
+			else if(curr.second == 0)
 			{
-				typename std::map<element_type,sorttrie>::reverse_iterator it = curr->rbegin();
-				while(it != curr->rend())
+				curr.second = 1;
+				stack.push_back(std::pair<size_type,int>(arena[n].lo, 0));
+			}
+			else if(curr.second == 1)
+			{
+				curr.second = 2;
+				if(arena[n].eq == none)
 				{
-					s.push(&((*it).second));
+					if(it == frontit)
+					{ // More leaves than suffixes, should never happen.
+						return std::distance(backit, frontit) + 1;
+					}
+					*it = arena[n].idx;
 					++it;
 				}
+				else
+				{
+					stack.push_back(std::pair<size_type,int>(arena[n].eq, 0));
+				}
+			}
+			else
+			{
+				stack.pop_back();
+				stack.push_back(std::pair<size_type,int>(arena[n].hi, 0));
 			}
 		}
-		return uit;
+		return std::distance(backit, it);
 	}
 	
-	template <class V>
+	template <class V, class P>
 	void
-	suffixarray<V>::sorttrie::print(std::ostream &os) {
+	suffixarray<V,P>::sorttrie::print(std::ostream &os) {
 		// print the sorttrie
 		// purely for debugging purposes.
-		size_type d = 0;
-		// It is very convenient that for pretty printing the depth is a known value.
-		while(d < depth)
+		if(arena.size() > 0)
 		{
-			os << "-\t";
-			++d;
+			os << std::endl;
+			print(os, arena[0].eq, 1);
 		}
-		os << cont[depth+idx];
-		os << std::endl;
-		typename std::map<element_type,sorttrie>::iterator bit = begin();
-		typename std::map<element_type,sorttrie>::iterator eit = end();
-		while(bit != eit)
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::sorttrie::print(std::ostream &os, size_type n, size_type d) {
+		// In-order walk of the siblings, every node followed by its children.
+		if(n == none)
 		{
-			std::pair<element_type,sorttrie> curr = *bit;
-			curr.second.print(os);
-			++bit;
+			return;
+		}
+		print(os, arena[n].lo, d);
+		for(size_type t = 0; t < d; t++)
+		{
+			os << "-\t";
 		}
+		os << getelem(n) << std::endl;
+		print(os, arena[n].eq, d+1);
+		print(os, arena[n].hi, d);
 	}
 	
 	
@@ -836,55 +1632,71 @@ public:
 	// suffixarray private functions:
 	//
 	
-	template <class V>
+	template <class V, class P>
 	void
-	suffixarray<V>::fill_lcp()
+	suffixarray<V,P>::fill_lcp(unsigned int threads)
 	{
 		// GENERATE all lcp values
-		// Implemented from Algorithm 4.1 from "Replacing sufﬁx trees with enhanced sufﬁx arrays"
-		// Abouelhoda, Kurtz, Ohlebusch 2003
-		
-		std::vector<size_type> rank(idx.size());
-		for(size_type i = 0; i < idx.size();i++)
+		// Implemented from the sparse Phi algorithm in "Permuted Longest-Common-Prefix Array"
+		// Karkkainen, Manzini, Puglisi 2009.
+		// Instead of a rank (or Phi) array of n entries only the plcp values of every
+		// lcpsample-th text position are computed and stored. The lcp of any other suffix
+		// is then extended from the lower bound plcp[j] >= plcp[j0] - (j - j0) given by the
+		// sample j0 before it. Both passes are split in blocks that run in parallel.
+		const size_type none = (size_type) -1;
+		size_type n = idx.size();
+		if(n == 0)
+		{
+			return;
+		}
+		std::vector<size_type> plcp((n + lcpsample - 1) / lcpsample, none);
+		for(size_type i = 0; i < n; i++)
 		{
-			if(idx.at(i) > rank.size())
+			if(idx[i] % lcpsample == 0)
 			{
-				std::cerr << "ERROR ERROR, idx.at(i) too large. i: " << i << " idx.at(i):" << idx.at(i) << std::endl;
+				plcp[idx[i] / lcpsample] = i > 0 ? (size_type) idx[i-1] : none;
 			}
-			rank.at(idx.at(i)) = i;
 		}
-		size_type h = 0;
-		for( size_type i = 0; i < idx.size();i++)
+		workstealingpool< std::pair<size_type,size_type> > pool(threads);
+		lcpbuilder builder(*this, plcp, pool.size());
+		// Blocks of about a quarter of the work per thread, so the pool can balance.
+		size_type block = std::max((size_type) 1, (size_type) (plcp.size() / (4 * pool.size())));
+		for(size_type b = 0; b < plcp.size(); b += block)
+		{
+			pool.push((unsigned int) (b / block), std::pair<size_type,size_type>(b, std::min(plcp.size(), b + block)));
+		}
+		pool.run(builder);
+		builder.phase = 2;
+		block = std::max((size_type) 1, (size_type) (n / (4 * pool.size())));
+		for(size_type b = 0; b < n; b += block)
+		{
+			pool.push((unsigned int) (b / block), std::pair<size_type,size_type>(b, std::min(n, b + block)));
+		}
+		pool.run(builder);
+		for(size_type w = 0; w < builder.exceptions.size(); w++)
 		{
-			if(rank.at(i) > 0 and rank.at(i) <= idx.size())
+			for(size_type e = 0; e < builder.exceptions[w].size(); e++)
 			{
-				int k = idx.at(rank.at(i)-1);
-				while(content.at(i+h) == content.at(k+h))
-				{
-					h++;
-				}
-				tabs.setlcp( rank.at(i), h);
-				if(h > 0)
-				{
-					h--;
-				}
-			} 
+				tabs.setlcp(builder.exceptions[w][e].first, builder.exceptions[w][e].second);
+			}
 		}
 	}
 	
-	template <class V>
+	template <class V, class P>
 	void
-	suffixarray<V>::fill_up_down_nextl()
+	suffixarray<V,P>::fill_up_down_nextl()
 	{
 		// Fills the nextlIndex array (actually vector)
 		// Value -1 denotes empty
 		// Implemented from Algorithms 6.2 and 6.5 from "Replacing suffix threes with enhances suffix arrays"
+		// The lcp exceptions are looked up below, so freeze them first.
+		tabs.freeze();
 		size_type lastIndex = -1;
 		std::stack<size_type> updownstack;
 		updownstack.push(0);
 		std::stack<size_type> nextlstack;
 		nextlstack.push(0);
-		for( size_type i = 1; i < idx.size(); i++)
+		for( size_type i = 1; i < tabs.size(); i++)
 		{
 			while(tabs.getlcp(i) < tabs.getlcp(updownstack.top()))
 			{
@@ -916,9 +1728,9 @@ public:
 		}
 	}
 	
-	template <class V>
+	template <class V, class P>
 	typename V::size_type
-	suffixarray<V>::getlcp( const interval& inter)
+	suffixarray<V,P>::getlcp( const interval& inter) const
 	{
 	//	std::cerr << "getLCP:: [" << inter.i << "," << inter.j <<"] size: " << inter.size() << std::endl;
 		if(inter.size() == 1)
@@ -944,17 +1756,25 @@ public:
 	}
 	
 	
-	template <class V>
-	std::vector<typename suffixarray<V>::interval>
-	suffixarray<V>::getChildIntervals( const interval& parent)
+	template <class V, class P>
+	std::vector<typename suffixarray<V,P>::interval>
+	suffixarray<V,P>::getChildIntervals( const interval& parent) const
 	{
-		// Implemented from Algoarithms 6.7 from "Replacing suffix threes with enhances suffix arrays"
 		std::vector<interval> found;
+		getChildIntervals(parent, found);
+		return found;
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::getChildIntervals( const interval& parent, std::vector<interval>& found) const
+	{
+		// Implemented from Algoarithms 6.7 from "Replacing suffix threes with enhances suffix arrays"
 		size_type i1;
 		size_type i2;
 		if(parent.i == parent.j || parent.i >= idx.size() || parent.j >= idx.size())
 		{ // Interval of size 1, doesn't get smaller than this.
-			return found;
+			return;
 		}
 		//std::cerr << "SARR.gci: finding children for interval: [" << parent.i << "," << parent.j << "]" << std::endl;
 		if( parent.j+1 < idx.size())
@@ -993,12 +1813,11 @@ public:
 		}
 		//std::cerr << "test2 " << std::endl;
 		found.push_back(interval(i1,parent.j));
-		return found;
 	}
 	
-	template <class V>
+	template <class V, class P>
 	void
-	suffixarray<V>::processline( const std::string& line)
+	suffixarray<V,P>::processline( const std::string& line)
 	{
 		std::stringstream ss(line);
 		std::string item;
@@ -1048,16 +1867,25 @@ public:
 		
 	}
 	
-	template <class V>
+	template <class V, class P>
 	void
-	suffixarray<V>::ds()
+	suffixarray<V,P>::ds(unsigned int threads)
 	{
 		// Attempts smart-ish sorting by first creating buckets (with depth 1)
 		// and then sorting each of these buckets seperately.
-		std::cerr << "\t\tSARR.DS starting" << std::endl;
-		sort(idx.begin(),idx.end(), SACmp(content,0,2));
-		typename std::vector<size_type>::iterator searchit = idx.begin();
-		typename std::vector<size_type>::iterator backit = idx.begin();
+		stats.start("buckets");
+		if(idx.size() < 2)
+		{
+			return;
+		}
+		parallelsort(idx.begin(),idx.end(), SACmp(content,0,2), threads);
+		stats.start("ds2");
+		// Sorts the buckets when running on one thread.
+		sorttrie trie(content);
+		// Buckets to sort, as offsets in idx, when running with more than one thread.
+		std::vector< std::pair<size_type,size_type> > buckets;
+		saiterator searchit = idx.begin();
+		saiterator backit = idx.begin();
 		element_type curra = content[*searchit];
 		element_type currb = content[(*searchit)+1];
 		++searchit;
@@ -1071,328 +1899,1067 @@ public:
 			{
 				curra = content[*searchit];
 				currb = content[(*searchit)+1];
-				if(distance(backit,searchit) > 1)
+				stats.addbucket(std::distance(backit,searchit));
+				if(std::distance(backit,searchit) > 1)
 				{
-					ds2(backit, searchit,2);
+					if(threads > 1)
+					{
+						buckets.push_back(std::pair<size_type,size_type>(backit-idx.begin(), searchit-idx.begin()));
+					}
+					else
+					{
+						ds2(backit, searchit,2,trie);
+					}
 				}
 				backit = searchit;
 			}
 			
 			++searchit;
 		}
-		// NOTE: last two elements are already really sorted!
-		// so we don't sort those.
-		--searchit;
-		if(backit != searchit)
+		// NOTE: the last element, if it is the unique sentinel, is already in its place.
+		// It was never compared above, so it is part of the last bucket: don't sort it.
+		if(idx.back() + 1 == content.size())
 		{
 			--searchit;
-			// If the last bucket actually contains something sort.
-			if(backit != searchit)
+		}
+		stats.addbucket(std::distance(backit,searchit));
+		if(std::distance(backit,searchit) > 1)
+		{
+			if(threads > 1)
 			{
-				if(distance(backit,searchit) > 1)
+				buckets.push_back(std::pair<size_type,size_type>(backit-idx.begin(), searchit-idx.begin()));
+			}
+			else
+			{
+				ds2(backit, searchit,2,trie);
+			}
+		}
+		if(threads > 1)
+		{
+			dsparallel(buckets, threads);
+		}
+		stats.stop();
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::dsparallel(const std::vector< std::pair<size_type,size_type> >& buckets, unsigned int threads)
+	{
+		// Buckets larger than splitsize are split on their third element, smaller
+		// neighbouring buckets are batched into tasks of about splitsize/4 suffixes.
+		size_type splitsize = std::max((size_type) 8192, (size_type) (idx.size() / (threads * 16)));
+		workstealingpool<buckettask> pool(threads);
+		unsigned int w = 0;
+		size_type batch = 0;
+		size_type batchsize = 0;
+		for(size_type b = 0; b < buckets.size(); b++)
+		{
+			size_type size = buckets[b].second - buckets[b].first;
+			if(size >= splitsize)
+			{
+				if(batchsize > 0)
 				{
-					ds2(backit, searchit,2);
+					pool.push(w++, buckettask(buckets[batch].first, buckets[b-1].second, 0, 2, false));
 				}
+				pool.push(w++, buckettask(buckets[b].first, buckets[b].second, 2, 2, true));
+				batch = b+1;
+				batchsize = 0;
+				continue;
+			}
+			batchsize += size;
+			if(batchsize >= splitsize / 4)
+			{
+				pool.push(w++, buckettask(buckets[batch].first, buckets[b].second, 0, 2, false));
+				batch = b+1;
+				batchsize = 0;
 			}
 		}
-		std::cerr << "\t\tSARR.DS done!" << std::endl;
+		if(batchsize > 0)
+		{
+			pool.push(w++, buckettask(buckets[batch].first, buckets.back().second, 0, 2, false));
+		}
+		bucketsorter sorter(*this, pool, splitsize);
+		pool.run(sorter);
 	}
 	
-	template <class V>
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::samebucket(size_type x, size_type y, int from, int to) const
+	{
+		for(int d = from; d < to; d++)
+		{
+			if(content[x+d] != content[y+d])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	
+	template <class V, class P>
 	void
-	suffixarray<V>::ds2(typename std::vector<size_type>::iterator backit, typename std::vector<size_type>::iterator frontit, int startdepth)
+	suffixarray<V,P>::ds2(saiterator backit, saiterator frontit, int startdepth, sorttrie& trie)
 	{
-		if(distance(backit,frontit) < 5)
+		if(std::distance(backit,frontit) < 5)
 		{ // A bit of a magic number, but no real need to build a tree for really small buckets!
-			sort(backit,frontit,SACmp(content,startdepth,-1));
+			std::sort(backit,frontit,SACmp(content,startdepth,-1));
 			return;
 		}
+		// build the trie and write the suffixes back in sorted order
+		size_type sorted = trie.sort(backit, frontit, startdepth);
+		if(sorted != (size_type) std::distance(backit, frontit))
+		{
+			std::cerr << "SIZE MISMATCH! :: " << sorted << " sorted elements for " << std::distance(backit,frontit) << "positions!" << std::endl;
+			trie.print(std::cerr);
+			exit(0);
+		}
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::sais()
+	{
+		// Rank the elements, SA-IS works on integer alphabets.
+		// A virtual 0 is appended as the sentinel, it sorts before every suffix
+		// and is dropped afterwards. Because the last element of the content is
+		// unique no suffix is a prefix of another, so the order of the other
+		// suffixes is not affected by it.
+		std::vector<size_type> t;
+		size_type k = elementranks<element_type>::rank(content, t);
+		std::vector<size_type> sa;
+		sais(t, sa, k);
+		idx.assign(sa.begin()+1, sa.end());
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::buckets(const std::vector<size_type>& t, std::vector<size_type>& bkt, size_type k, bool end)
+	{
+		bkt.assign(k, 0);
+		for(size_type i = 0; i < t.size(); i++)
+		{
+			++bkt[t[i]];
+		}
+		size_type sum = 0;
+		for(size_type c = 0; c < k; c++)
+		{
+			sum += bkt[c];
+			bkt[c] = end ? sum : sum - bkt[c];
+		}
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::induce(const std::vector<size_type>& t, const std::vector<bool>& stype, std::vector<size_type>& sa, size_type k)
+	{
+		const size_type empty = (size_type) -1;
+		std::vector<size_type> bkt;
+		buckets(t, bkt, k, false);
+		for(size_type i = 0; i < sa.size(); i++)
+		{
+			if(sa[i] != empty && sa[i] > 0 && !stype[sa[i]-1])
+			{
+				size_type j = sa[i]-1;
+				sa[bkt[t[j]]++] = j;
+			}
+		}
+		buckets(t, bkt, k, true);
+		for(size_type i = sa.size(); i-- > 0;)
+		{
+			if(sa[i] != empty && sa[i] > 0 && stype[sa[i]-1])
+			{
+				size_type j = sa[i]-1;
+				sa[--bkt[t[j]]] = j;
+			}
+		}
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::sais(const std::vector<size_type>& t, std::vector<size_type>& sa, size_type k)
+	{
+		// Implemented from "Linear Suffix Array Construction by Almost Pure Induced-Sorting"
+		// Nong, Zhang, Chan 2009
+		const size_type empty = (size_type) -1;
+		size_type n = t.size();
+		sa.assign(n, empty);
+		if(n == 1)
+		{
+			sa[0] = 0;
+			return;
+		}
+		// Classify the suffixes, S-type if smaller than its right neighbour.
+		std::vector<bool> stype(n, false);
+		stype[n-1] = true;
+		for(size_type i = n-1; i-- > 0;)
+		{
+			stype[i] = t[i] < t[i+1] || (t[i] == t[i+1] && stype[i+1]);
+		}
+		// Leftmost S-type positions (LMS) are sorted first.
+		std::vector<size_type> bkt;
+		buckets(t, bkt, k, true);
+		for(size_type i = 1; i < n; i++)
+		{
+			if(islms(stype, i))
+			{
+				sa[--bkt[t[i]]] = i;
+			}
+		}
+		induce(t, stype, sa, k);
 		
-		typename std::vector<size_type>::iterator it = backit;
-		// build the trie
-		sorttrie root(content, startdepth-1, *it);
-		root.makeChildSelf();
-		++it;
-		int count = 1;
-		while(it != frontit)
+		// Compact the sorted LMS substrings and name them.
+		size_type n1 = 0;
+		for(size_type i = 0; i < n; i++)
 		{
-			//root.print(std::cerr);
-			root.walkNadd(startdepth, *it);
-			++it;
-			++ count;
+			if(islms(stype, sa[i]))
+			{
+				sa[n1++] = sa[i];
+			}
 		}
-		//std::cerr << "Inserted : " << count << " elements in the tree" << std::endl;
-		// depth-first traversal of the trie
-		std::vector<size_type> sorted = root.getSort(root);
-		// change values to sorted values
-		it = backit;
-		if(sorted.size() != (typename std::vector<size_type>::size_type) distance(backit, frontit))
+		std::fill(sa.begin()+n1, sa.end(), empty);
+		size_type name = 0;
+		size_type prev = empty;
+		for(size_type i = 0; i < n1; i++)
 		{
-			std::cerr << "SIZE MISMATCH! :: " << sorted.size() << " sorted elements for " << distance(backit,frontit) << "positions!" << std::endl;
-			root.print(std::cerr);
-			exit(0);
+			size_type pos = sa[i];
+			bool diff = false;
+			for(size_type d = 0; ; d++)
+			{
+				if(prev == empty || t[pos+d] != t[prev+d] || stype[pos+d] != stype[prev+d])
+				{
+					diff = true;
+					break;
+				}
+				if(d > 0 && (islms(stype, pos+d) || islms(stype, prev+d)))
+				{
+					break;
+				}
+			}
+			if(diff)
+			{
+				++name;
+				prev = pos;
+			}
+			sa[n1 + pos/2] = name-1;
 		}
-		typename std::vector<size_type>::iterator itt = sorted.begin();
-		while(it != frontit)
+		std::vector<size_type> s1;
+		s1.reserve(n1);
+		for(size_type i = n1; i < n; i++)
 		{
-			size_type temp = (*itt);
-			(*it) = temp;
-			++it;
-			++itt;
+			if(sa[i] != empty)
+			{
+				s1.push_back(sa[i]);
+			}
+		}
+		
+		// Sort the reduced problem, recursively if the names are not unique.
+		std::vector<size_type> sa1;
+		if(name < n1)
+		{
+			sais(s1, sa1, name);
+		}
+		else
+		{
+			sa1.resize(n1);
+			for(size_type i = 0; i < n1; i++)
+			{
+				sa1[s1[i]] = i;
+			}
+		}
+		
+		// Induce the full order from the sorted LMS suffixes.
+		for(size_type i = 1, j = 0; i < n; i++)
+		{
+			if(islms(stype, i))
+			{
+				s1[j++] = i;
+			}
+		}
+		for(size_type i = 0; i < n1; i++)
+		{
+			sa1[i] = s1[sa1[i]];
 		}
+		std::fill(sa.begin(), sa.end(), empty);
+		buckets(t, bkt, k, true);
+		for(size_type i = n1; i-- > 0;)
+		{
+			size_type j = sa1[i];
+			sa[--bkt[t[j]]] = j;
+		}
+		induce(t, stype, sa, k);
 	}
 	
 	//
 	// Suffixarray Public functions:
 	//
 		
-	template <class V>
-	suffixarray<V>::suffixarray(const value_type& s): content(s)
+	template <class V, class P>
+	suffixarray<V,P>::suffixarray(const value_type& s, sortmethod method, unsigned int threads): content(s)
 	{
 		// NOTE: IMPORTANT:
 		// LAST ELEMENT OF s _MUST_ BE UNIQUE
 		// LAST ELEMENT OF s _MUST_ BE > THAN ALL OTHER ELEMENTS
 		// Constructor initialising an array.
 		// Initialise content and size
-		std::cerr << "SARR CONSTRUCTOR" << std::endl;
+		if(s.size() > 0 && (uint64_t) s.size() - 1 > (uint64_t) std::numeric_limits<index_type>::max())
+		{
+			std::cerr << "The corpus is too large for the index type of the storage policy" << std::endl;
+			return;
+		}
+		stats.start("fill");
 		size_type i = 0;
-		std::cerr << "\tfilling index" << std::endl;
 		while(i < s.size())
 		{
 			idx.push_back(i);
 			++i;
 		}
-		std::cerr << "\tsorting index" << std::endl;
 		// sort (make the suffix array a suffix array)
 		//sort(idx.begin(),idx.end(), SACmp( content,0,-1 ));
-		ds();
+		if(method == INDUCEDSORTING)
+		{
+			stats.start("sais");
+			sais();
+		}
+		else
+		{
+			ds(threads);
+		}
 		
 		// generate the lcp table in the vector<int> lcp
 		tabs = childtabs();
 		tabs.init_tabs( idx.size() );
 		
-		std::cerr << "\tgenerating lcp" << std::endl;
-		fill_lcp();
+		stats.start("lcp");
+		fill_lcp(threads);
 		// up, down, nexlindex
-		std::cerr << "\tgenerating up, down and nextl index" << std::endl;
+		stats.start("updownnextl");
 		fill_up_down_nextl();
-		std::cerr << "SARR CONSTRUCTOR DONE" << std::endl;
+		tabs.freeze();
+		fill_roottable();
+		stats.stop();
+		tabs.countexceptions(stats);
 	}
 	
-	template <class V>
-	suffixarray<V>::suffixarray( const value_type& s, const std::string& f ): content( s )
+	template <class V, class P>
+	suffixarray<V,P>::suffixarray( const value_type& s, const std::string& f ): content( s )
 	{
 		// Initialise a suffixarray which has been previously stored to disk!
+		stats.start("load");
+		if(isbinary(f))
+		{
+			mapbinary(mappedfile(f), 0);
+			fill_roottable();
+			stats.stop();
+			tabs.countexceptions(stats);
+			return;
+		}
+		if(isarchive(f))
+		{
+			viewbinary(openarchive(mappedfile(f)));
+			fill_roottable();
+			stats.stop();
+			tabs.countexceptions(stats);
+			return;
+		}
 		tabs = childtabs();
 		tabs.init_tabs( s.size());
+		idx.resize( s.size());
 		
-		std::ifstream myfile (f);
+		std::ifstream myfile (f.c_str());
 		std::string line;
 		if (myfile.is_open())
 		{
-			while (! myfile.eof() )
+			while (getline (myfile,line))
 			{
-				getline (myfile,line);
-				processline(line);
+				if(line.size() > 0)
+				{
+					processline(line);
+				}
 			}
 			myfile.close();
 		}
+		tabs.freeze();
+		fill_roottable();
+		stats.stop();
+		tabs.countexceptions(stats);
 	}
 	
-	template <class V>
+	template <class V, class P>
+	suffixarray<V,P>::suffixarray( const value_type& s, const mappedfile& m, size_type offset ): content( s )
+	{
+		stats.start("load");
+		mapbinary(m, offset);
+		fill_roottable();
+		stats.stop();
+		tabs.countexceptions(stats);
+	}
+	
+	template <class V, class P>
 	bool
-	suffixarray<V>::suffixarray::savesarray( const std::string& f)
+	suffixarray<V,P>::mapbinary( const mappedfile& m, size_type offset)
 	{
-		// save array to file
-		std::ofstream myfile (f);
-		if (myfile.is_open())
+		if(!m.good() || offset >= m.size())
 		{
-			print(myfile);
-			myfile.close();
-			return true;
+			return false;
 		}
-		std::cerr << "Unable to open file" << std::endl;
-		return false;
+		sectionreader r(m.data() + offset, m.size() - offset, binarymagic(), binaryversion, sizeof(size_type));
+		if(!r.good() || !viewbinary(r))
+		{
+			return false;
+		}
+		mapping = m;
+		return true;
 	}
 	
+	template <class V, class P>
+	template <class R>
+	bool
+	suffixarray<V,P>::viewbinary( const R& r)
+	{
+		// A reader that is not good has already said why (truncated or damaged).
+		if(!r.good())
+		{
+			return false;
+		}
+		if(r.sections() != 1 + childtabs::sections)
+		{
+			std::cerr << "Binary index is damaged" << std::endl;
+			return false;
+		}
+		if(r.getcount() != content.size())
+		{
+			std::cerr << "Binary index was not build on this content" << std::endl;
+			return false;
+		}
+		flatarray<index_type> sa;
+		if(!r.view(0, sa) || sa.size() != content.size() || !tabs.viewsections(r, 1, content.size()))
+		{
+			std::cerr << "Binary index is damaged or uses another storage policy" << std::endl;
+			tabs = childtabs();
+			return false;
+		}
+		idx = sa;
+		return true;
+	}
 	
-	template <class V>
-	typename suffixarray<V>::size_type
-	suffixarray<V>::find_position( const value_type& w, element_type wildcard) const {
-		// Check if sentence is a substring in the suffix array. Throw a
-		// StringNotFound if it is not.
-		size_type depth = 0;
-		std::vector<interval> tosearch;
-		tosearch.push_back(interval(0,idx.size()-1));
-		while(depth < w.size() && tosearch.size() > 0)
-		{
-			std::vector<interval> tosearch2;
-			for( size_type i = 0; i < tosearch.size(); i++)
-			{
-				interval curr = tosearch.at(i);
-				std::vector<interval> nieuw;
-				if(depth < getlcp(curr) || curr.size() == 1)
-				{ // no need to generate children! interval is equal for the first getlcp() elements
-					// We also don't need to generate children if the interval has size 1
-					nieuw.push_back(curr);
+	template <class V, class P>
+	suffixarray<V,P>::suffixarray( const value_type& s, const archivereader& a ): content( s )
+	{
+		stats.start("decode");
+		if(a.good())
+		{
+			viewbinary(a);
+		}
+		fill_roottable();
+		stats.stop();
+		tabs.countexceptions(stats);
+	}
+	
+	template <class V, class P>
+	suffixarray<V,P>::suffixarray( const value_type& s, size_type first, size_type last, unsigned int threads ): content( s )
+	{
+		for(size_type i = first; i < last; i++)
+		{
+			idx.push_back(i);
+		}
+		ds(threads);
+	}
+	
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::buildexternal( const value_type& s, const std::string& f, size_type membudget, const std::string& tmpdir, unsigned int threads)
+	{
+		// Semi-external construction:
+		// 1. sort the suffixes starting in each partition of the content and write them to a run file,
+		// 2. merge the runs with a heap, writing the suffixarray to a temporary file,
+		// 3. compute the lcp values from that file with sparse Phi,
+		// 4. compute up, down and nextl from the lcp values,
+		// 5. write the binary index file, streaming the suffixarray section from disk.
+		size_type n = s.size();
+		// A partition needs its suffixes plus about as much again for sorting them.
+		size_type partition = std::max((size_type) 1024, membudget / (2 * sizeof(size_type)));
+		std::ostringstream prefix;
+		prefix << tmpdir << "/sarr." << getpid() << ".";
+		std::vector<std::string> runs;
+		bool ok = true;
+		for(size_type first = 0; first < n && ok; first += partition)
+		{
+			suffixarray<V,P> part(s, first, std::min(n, first + partition), threads);
+			std::ostringstream name;
+			name << prefix.str() << runs.size() << ".run";
+			runs.push_back(name.str());
+			std::ofstream out(name.str().c_str(), std::ios::out | std::ios::binary);
+			out.write((const char*) &part.idx[0], part.idx.size() * sizeof(index_type));
+			ok = out.good();
+		}
+		
+		// The merge buffers share the budget, half for the runs and half for the output.
+		std::string safile = prefix.str() + "sa";
+		suffixarray<V,P> result(s, 0, 0, 1);
+		result.tabs.init_tabs(n);
+		if(ok)
+		{
+			size_type buffer = std::max((size_type) 64, membudget / (2 * sizeof(size_type) * (runs.size() + 1)));
+			std::vector<runreader*> readers;
+			std::priority_queue< std::pair<size_type,size_type>, std::vector< std::pair<size_type,size_type> >, runcmp > heap((runcmp(s)));
+			for(size_type r = 0; r < runs.size(); r++)
+			{
+				readers.push_back(new runreader(runs[r], buffer));
+				if(readers[r]->next())
+				{
+					heap.push(std::pair<size_type,size_type>(readers[r]->head(), r));
 				}
-				else
-				{ // we need to generate children!
-					nieuw = getChildIntervals(tosearch.at(i));
+			}
+			std::ofstream out(safile.c_str(), std::ios::out | std::ios::binary);
+			std::vector<index_type> outbuf;
+			outbuf.reserve(buffer * runs.size());
+			while(!heap.empty())
+			{
+				size_type curr = heap.top().first;
+				size_type r = heap.top().second;
+				heap.pop();
+				if(readers[r]->next())
+				{
+					heap.push(std::pair<size_type,size_type>(readers[r]->head(), r));
 				}
-				for( size_type in = 0; in < nieuw.size(); in++)
+				outbuf.push_back(curr);
+				if(outbuf.size() == outbuf.capacity())
 				{
-					// Filter the children and if they are still OK at this depth add them for the next round!
-					element_type tocomp = w.at(depth);
-					if(tocomp == wildcard)
-					{
-						tosearch2.push_back(nieuw.at(in));
-					}
-					else
-					{
-						curr = nieuw.at(in);
-						if( ( idx.at(curr.i) + depth) < content.size())
-						{
-							element_type tocomp2 = content.at(idx.at( curr.i ) + depth);
-							if(tocomp == tocomp2)
-							{
-								tosearch2.push_back(nieuw.at(in));
-							}
-						}
-					}
+					out.write((const char*) &outbuf[0], outbuf.size() * sizeof(index_type));
+					outbuf.clear();
 				}
 			}
-			tosearch = tosearch2;
-			depth++;
+			if(outbuf.size() > 0)
+			{
+				out.write((const char*) &outbuf[0], outbuf.size() * sizeof(index_type));
+			}
+			ok = out.good();
+			out.close();
+			for(size_type r = 0; r < readers.size(); r++)
+			{
+				delete readers[r];
+				std::remove(runs[r].c_str());
+			}
 		}
-		if(tosearch.size() > 0)
+		
+		if(ok)
 		{
-			return idx.at(tosearch.at(0).i);
-		}
-		throw StringNotFound();
-	}
-	
-	template <class V>
-	std::vector<typename suffixarray<V>::size_type>
-	suffixarray<V>::find_all_positions( const value_type& w, element_type wildcard) const {
-		std::vector<size_type> results;
-		size_type depth = 0;
-		std::vector<interval> tosearch;
-		tosearch.push_back(interval(0,idx.size()-1));
-		while(depth < w.size() && tosearch.size() > 0)
-		{
-			std::vector<interval> tosearch2;
-			for( size_type i = 0; i < tosearch.size(); i++)
-			{
-				interval curr = tosearch.at(i);
-				std::vector<interval> nieuw;
-				if(depth < getlcp(curr) || curr.size() == 1)
-				{ // no need to generate children! interval is equal for the first getlcp() elements
-					// We also don't need to generate children if the interval has size 1
-					nieuw.push_back(curr);
+			// The lcp values with the sparse Phi algorithm of fill_lcp, reading the suffixarray
+			// file twice: once for the predecessor of every sampled position, whose plcp values
+			// are then computed in text order, and once to extend every lcp from the sample
+			// before it. The comparisons stop at the end of the content.
+			const size_type none = (size_type) -1;
+			// The two readers share the budget.
+			size_type buffer = std::max((size_type) 64, membudget / (2 * sizeof(size_type)));
+			std::vector<size_type> plcp((n + lcpsample - 1) / lcpsample, none);
+			runreader phi(safile, buffer);
+			size_type prev = none;
+			for(size_type i = 0; i < n && phi.next(); i++)
+			{
+				if(phi.head() % lcpsample == 0)
+				{
+					plcp[phi.head() / lcpsample] = prev;
 				}
-				else
-				{ // we need to generate children!
-					nieuw = getChildIntervals(tosearch.at(i));
+				prev = phi.head();
+			}
+			size_type h = 0;
+			for(size_type p = 0; p < plcp.size(); p++)
+			{
+				size_type j = p * lcpsample;
+				size_type k = plcp[p];
+				if(k == none)
+				{ // The smallest suffix has no predecessor.
+					plcp[p] = 0;
+					h = 0;
+					continue;
 				}
-				for( size_type in = 0; in < nieuw.size(); in++)
+				while(j + h < n && k + h < n && s[j+h] == s[k+h])
 				{
-					// Filter the children and if they are still OK at this depth add them for the next round!
-					element_type tocomp = w.at(depth);
-					if(tocomp == wildcard)
-					{
-						tosearch2.push_back(nieuw.at(in));
-					}
-					else
+					h++;
+				}
+				plcp[p] = h;
+				h = h > lcpsample ? h - lcpsample : 0;
+			}
+			runreader sa(safile, buffer);
+			for(size_type i = 0; i < n && sa.next(); i++)
+			{
+				size_type j = sa.head();
+				if(i > 0)
+				{
+					size_type skip = j % lcpsample;
+					h = plcp[j / lcpsample];
+					h = h > skip ? h - skip : 0;
+					while(j + h < n && prev + h < n && s[j+h] == s[prev+h])
 					{
-						curr = nieuw.at(in);
-						if( ( idx.at(curr.i) + depth) < content.size())
-						{
-							element_type tocomp2 = content.at(idx.at( curr.i ) + depth);
-							if(tocomp == tocomp2)
-							{
-								tosearch2.push_back(nieuw.at(in));
-							}
-						}
+						h++;
 					}
+					result.tabs.setlcp(i, h);
 				}
+				prev = j;
 			}
-			tosearch = tosearch2;
-			depth++;
 		}
-		for( size_type i = 0; i < tosearch.size(); i++)
+		
+		if(ok)
+		{
+			result.fill_up_down_nextl();
+			result.tabs.freeze();
+			// The layout of binarywriter, with the suffixarray section streamed from its file.
+			std::ifstream sa(safile.c_str(), std::ios::in | std::ios::binary);
+			sectionwriter w(binarymagic(), binaryversion, sizeof(size_type), n);
+			w.add(sa, (sectionwriter::offset_type) n * sizeof(index_type));
+			result.tabs.addsections(w);
+			std::ofstream myfile (f.c_str(), std::ios::out | std::ios::binary);
+			ok = w.write(myfile);
+			myfile.close();
+			ok = ok && !myfile.fail();
+		}
+		else
 		{
-			interval curr = tosearch.at(i);
-			for(size_type j = curr.i; j <= curr.j;j++)
+			for(size_type r = 0; r < runs.size(); r++)
 			{
-				results.push_back(idx.at(j));
+				std::remove(runs[r].c_str());
 			}
 		}
-		return results;
+		std::remove(safile.c_str());
+		if(!ok)
+		{
+			std::cerr << "Unable to write file" << std::endl;
+		}
+		return ok;
+	}
+	
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::suffixarray::savesarray( const std::string& f)
+	{
+		// save array to file
+		std::ofstream myfile (f.c_str());
+		if (myfile.is_open())
+		{
+			print(myfile);
+			myfile.close();
+			return true;
+		}
+		std::cerr << "Unable to open file" << std::endl;
+		return false;
 	}
 	
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::savebinary( const std::string& f) const
+	{
+		std::ofstream myfile (f.c_str(), std::ios::out | std::ios::binary);
+		if (myfile.is_open())
+		{
+			bool ok = writebinary(myfile);
+			myfile.close();
+			return ok && !myfile.fail();
+		}
+		std::cerr << "Unable to open file" << std::endl;
+		return false;
+	}
 	
-	template <class V>
-	typename suffixarray<V>::size_type
-	suffixarray<V>::find_all_positions_count( const value_type& w, element_type wildcard) {
-		size_type result=0;
-		size_type depth = 0;
-		std::vector<interval> tosearch;
-		tosearch.push_back(getRootInterval());
-		//std::cerr << "STARTING FAPC, query: " << w << std::endl;
-		while(depth < w.size() && tosearch.size() > 0)
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::writebinary( std::ostream& os) const
+	{
+		return binarywriter().write(os);
+	}
+	
+	template <class V, class P>
+	sectionwriter
+	suffixarray<V,P>::binarywriter() const
+	{
+		// Layout: the suffix array, then lcp, up, down and nextl each followed by the bits,
+		// rank directory and values of its exception table. See childtabs::addsections.
+		sectionwriter w(binarymagic(), binaryversion, sizeof(size_type), content.size());
+		w.add(idx);
+		tabs.addsections(w);
+		return w;
+	}
+	
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::isbinary( const std::string& f)
+	{
+		char magic[8];
+		std::ifstream myfile (f.c_str(), std::ios::in | std::ios::binary);
+		return myfile.read(magic, 8) && std::equal(magic, magic + 8, binarymagic());
+	}
+	
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::savearchive( const std::string& f, size_type blocksize) const
+	{
+		std::ofstream myfile (f.c_str(), std::ios::out | std::ios::binary);
+		if (myfile.is_open())
 		{
-			//std::cerr << " FAPC at depth: " << depth << " number of items to search: " << tosearch.size() << std::endl;
-			std::vector<interval> tosearch2;
-			for( size_type i = 0; i < tosearch.size(); i++)
+			bool ok = writearchive(myfile, blocksize);
+			myfile.close();
+			return ok && !myfile.fail();
+		}
+		std::cerr << "Unable to open file" << std::endl;
+		return false;
+	}
+	
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::writearchive( std::ostream& os, size_type blocksize) const
+	{
+		// The same sections as writebinary, compressed.
+		archivewriter w(content.size(), blocksize);
+		w.add(idx);
+		tabs.addsections(w);
+		return w.write(os, archivemagic(), archiveversion);
+	}
+	
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::isarchive( const std::string& f)
+	{
+		char magic[8];
+		std::ifstream myfile (f.c_str(), std::ios::in | std::ios::binary);
+		return myfile.read(magic, 8) && std::equal(magic, magic + 8, archivemagic());
+	}
+	
+	template <class V, class P>
+	archivereader
+	suffixarray<V,P>::openarchive( const mappedfile& m, size_type offset, unsigned int threads)
+	{
+		return archivereader(m, offset, archivemagic(), archiveversion, threads);
+	}
+	
+	
+	template <class V, class P>
+	typename suffixarray<V,P>::size_type
+	suffixarray<V,P>::bound( const value_type& w, bool upper) const {
+		// Every suffix in rows [lo-1,hi] shares at least min(matchlo, matchhi) elements with w,
+		// as those of rows lo-1 and hi do, so the comparisons start after them.
+		size_type lo = 0;
+		size_type hi = idx.size();
+		size_type matchlo = 0;
+		size_type matchhi = 0;
+		while(lo < hi)
+		{
+			size_type mid = lo + (hi - lo) / 2;
+			size_type p = idx[mid];
+			size_type d = std::min(matchlo, matchhi);
+			while(d < w.size() && p + d < content.size() && content[p + d] == w[d])
 			{
-				interval curr = tosearch.at(i);
-				std::vector<interval> nieuw;
-				if(depth < getlcp(curr) || curr.size() == 1)
-				{ // no need to generate children! interval is equal for the first getlcp() elements
-					// We also don't need to generate children if the interval has size 1
-					nieuw.push_back(curr);
-				}
-				else
-				{ // we need to generate children!
-					nieuw = getChildIntervals(tosearch.at(i));
-				}
-				for( size_type in = 0; in < nieuw.size(); in++)
+				d++;
+			}
+			// A suffix that ends before w does is smaller than w.
+			bool smaller = d < w.size() && (p + d >= content.size() || content[p + d] < w[d]);
+			if(smaller || (upper && d == w.size()))
+			{
+				lo = mid + 1;
+				matchlo = d;
+			}
+			else
+			{
+				hi = mid;
+				matchhi = d;
+			}
+		}
+		return lo;
+	}
+	
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::find_exact( const value_type& w, interval& found) const {
+		size_type first = bound(w, false);
+		size_type last = bound(w, true);
+		stats.addquery(0);
+		if(first >= last)
+		{
+			return false;
+		}
+		found = interval(first, last - 1);
+		return true;
+	}
+	
+	template <class V, class P>
+	std::vector<typename suffixarray<V,P>::interval>
+	suffixarray<V,P>::find_intervals( const value_type& w, element_type wildcard) const {
+		querycontext context;
+		return find_intervals(w, context, wildcard);
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::fill_roottable() {
+		roottable.clear();
+		if(idx.size() > 1 && tabs.size() == idx.size())
+		{
+			getChildIntervals(getRootInterval(), roottable);
+		}
+		rootindex.build(rootelement(*this), roottable.size());
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::useroottable( bool use) {
+		if(use)
+		{
+			fill_roottable();
+		}
+		else
+		{
+			std::vector<interval>().swap(roottable);
+			rootindex.clear();
+		}
+	}
+	
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::find_rootchild( const element_type& e, interval& found) const {
+		unsigned long k = rootindex.find(rootelement(*this), roottable.size(), e);
+		if(k == roottable.size())
+		{
+			return false;
+		}
+		found = roottable[k];
+		return true;
+	}
+	
+	template <class V, class P>
+	bool
+	suffixarray<V,P>::matches( const value_type& w, const interval& inter, size_type first, size_type last, element_type wildcard) const {
+		size_type p = idx[inter.i];
+		for(size_type d = first; d < last; d++)
+		{
+			// A wildcard also matches past the end of the content.
+			if(w[d] != wildcard && (p + d >= content.size() || !(content[p + d] == w[d])))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	
+	template <class V, class P>
+	template <class S>
+	void
+	suffixarray<V,P>::traverse( const value_type& w, S& sink, querycontext& context, element_type wildcard) const {
+		if(std::find(w.begin(), w.end(), wildcard) == w.end())
+		{
+			interval found(0, 0);
+			if(find_exact(w, found))
+			{
+				sink(found);
+			}
+			return;
+		}
+		// Walks the lcp-interval tree depth first. The children are pushed in reverse, so the
+		// intervals reach the sink in suffix array order.
+		std::vector< std::pair<interval, size_type> >& pending = context.pending;
+		std::vector<interval>& nieuw = context.children;
+		size_type expanded = 0;
+		pending.clear();
+		pending.push_back(std::make_pair(getRootInterval(), (size_type) 0));
+		while(!pending.empty())
+		{
+			interval curr = pending.back().first;
+			size_type depth = pending.back().second;
+			pending.pop_back();
+			if(depth < w.size())
+			{
+				// All suffixes of curr are equal up to its lcp (to their end if it has size 1),
+				// compare those elements at once.
+				size_type lcp = curr.size() == 1 ? w.size() : getlcp(curr);
+				if(depth < lcp)
 				{
-					// Filter the children and if they are still OK at this depth add them for the next round!
-					element_type tocomp = w.at(depth);
-					if(tocomp == wildcard)
+					size_type limit = std::min(lcp, (size_type) w.size());
+					if(!matches(w, curr, depth, limit, wildcard))
 					{
-						tosearch2.push_back(nieuw.at(in));
+						continue;
 					}
-					else
+					depth = limit;
+				}
+			}
+			if(depth == w.size())
+			{
+				if(!sink(curr))
+				{
+					break;
+				}
+				continue;
+			}
+			if(depth == 0 && !roottable.empty())
+			{ // the root, whose children are listed in roottable
+				if(!(w[0] == wildcard))
+				{
+					if(find_rootchild(w[0], curr))
 					{
-						curr = nieuw.at(in);
-						if( ( idx.at(curr.i) + depth) < content.size())
-						{
-							element_type tocomp2 = content.at(idx.at( curr.i ) + depth);
-							if(tocomp == tocomp2)
-							{
-								tosearch2.push_back(nieuw.at(in));
-							}
-						}
+						pending.push_back(std::make_pair(curr, (size_type) 1));
 					}
+					continue;
+				}
+				for(size_type in = roottable.size(); in > 0; in--)
+				{
+					pending.push_back(std::make_pair(roottable[in-1], (size_type) 1));
+				}
+				continue;
+			}
+			// The children differ in element depth.
+			nieuw.clear();
+			getChildIntervals(curr, nieuw);
+			expanded++;
+			for(size_type in = nieuw.size(); in > 0; in--)
+			{
+				if(matches(w, nieuw[in-1], depth, depth + 1, wildcard))
+				{
+					pending.push_back(std::make_pair(nieuw[in-1], depth + 1));
 				}
 			}
-			tosearch = tosearch2;
-			depth++;
 		}
-		for( size_type i = 0; i < tosearch.size(); i++)
+		stats.addquery(expanded);
+	}
+	
+	template <class V, class P>
+	const std::vector<typename suffixarray<V,P>::interval>&
+	suffixarray<V,P>::find_intervals( const value_type& w, querycontext& context, element_type wildcard) const {
+		context.current.clear();
+		intervalsink sink(context.current);
+		traverse(w, sink, context, wildcard);
+		return context.current;
+	}
+	
+	template <class V, class P>
+	typename suffixarray<V,P>::size_type
+	suffixarray<V,P>::find_position( const value_type& w, element_type wildcard) const {
+		querycontext context;
+		return find_position(w, context, wildcard);
+	}
+	
+	template <class V, class P>
+	typename suffixarray<V,P>::size_type
+	suffixarray<V,P>::find_position( const value_type& w, querycontext& context, element_type wildcard) const {
+		// Check if sentence is a substring in the suffix array. Throw a
+		// StringNotFound if it is not. The search stops at the first match.
+		firstsink sink;
+		traverse(w, sink, context, wildcard);
+		if(sink.found)
 		{
-			interval curr = tosearch.at(i);
-			result += curr.size();
+			return idx[sink.first];
 		}
-		return result;
+		throw StringNotFound();
 	}
 	
-	template <class V>
-	typename std::vector< typename suffixarray<V>::size_type >
-	suffixarray<V>::find_all_positions_skip( const std::vector< value_type >& w, size_type minskip, size_type maxskip, element_type wildcard) const
+	template <class V, class P>
+	std::vector<typename suffixarray<V,P>::size_type>
+	suffixarray<V,P>::find_all_positions( const value_type& w, element_type wildcard) const {
+		std::vector<size_type> results;
+		querycontext context;
+		find_all_positions(w, results, context, wildcard);
+		return results;
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::find_all_positions( const value_type& w, std::vector<size_type>& results, querycontext& context, element_type wildcard) const {
+		results.clear();
+		positionsink sink(idx, results);
+		traverse(w, sink, context, wildcard);
+	}
+	
+	
+	template <class V, class P>
+	typename suffixarray<V,P>::size_type
+	suffixarray<V,P>::find_all_positions_count( const value_type& w, element_type wildcard) const {
+		querycontext context;
+		return find_all_positions_count(w, context, wildcard);
+	}
+	
+	template <class V, class P>
+	typename suffixarray<V,P>::size_type
+	suffixarray<V,P>::find_all_positions_count( const value_type& w, querycontext& context, element_type wildcard) const {
+		countsink sink;
+		traverse(w, sink, context, wildcard);
+		return sink.count;
+	}
+	
+	template <class V, class P>
+	typename suffixarray<V,P>::size_type
+	suffixarray<V,P>::narrow( size_type first, size_type last, size_type d, const element_type& e, bool upper) const {
+		while(first < last)
+		{
+			size_type mid = first + (last - first) / 2;
+			size_type p = (size_type) idx[mid] + d;
+			bool before = p < content.size() && (upper ? !(e < content[p]) : content[p] < e);
+			if(before)
+			{
+				first = mid + 1;
+			}
+			else
+			{
+				last = mid;
+			}
+		}
+		return first;
+	}
+	
+	template <class V, class P>
+	std::vector<typename suffixarray<V,P>::size_type>
+	suffixarray<V,P>::find_all_positions_count_batch( const std::vector<value_type>& w, element_type wildcard) const {
+		std::vector<size_type> counts;
+		querycontext context;
+		find_all_positions_count_batch(w, counts, context, wildcard);
+		return counts;
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::find_all_positions_count_batch( const std::vector<value_type>& w, std::vector<size_type>& counts, querycontext& context, element_type wildcard) const {
+		counts.assign(w.size(), 0);
+		std::vector<size_type>& order = context.order;
+		order.clear();
+		for(size_type q = 0; q < w.size(); q++)
+		{
+			if(std::find(w[q].begin(), w[q].end(), wildcard) == w[q].end())
+			{
+				order.push_back(q);
+			}
+			else
+			{
+				counts[q] = find_all_positions_count(w[q], context, wildcard);
+			}
+		}
+		std::sort(order.begin(), order.end(), batchorder(w));
+		// ranges[d] holds the rows of the first d elements of the previous query.
+		std::vector< std::pair<size_type, size_type> >& ranges = context.ranges;
+		ranges.clear();
+		ranges.push_back(std::make_pair((size_type) 0, (size_type) idx.size()));
+		const value_type* previous = 0;
+		for(size_type i = 0; i < order.size(); i++)
+		{
+			const value_type& query = w[order[i]];
+			size_type shared = 0;
+			while(previous && shared < query.size() && shared < previous->size() && query[shared] == (*previous)[shared])
+			{
+				shared++;
+			}
+			ranges.resize(shared + 1);
+			for(size_type d = shared; d < query.size(); d++)
+			{
+				size_type first = ranges[d].first;
+				size_type last = ranges[d].second;
+				if(first < last)
+				{
+					first = narrow(ranges[d].first, ranges[d].second, d, query[d], false);
+					last = narrow(first, ranges[d].second, d, query[d], true);
+				}
+				ranges.push_back(std::make_pair(first, last));
+			}
+			counts[order[i]] = ranges.back().second - ranges.back().first;
+			stats.addquery(0);
+			previous = &query;
+		}
+	}
+	
+	template <class V, class P>
+	typename std::vector< typename suffixarray<V,P>::size_type >
+	suffixarray<V,P>::find_all_positions_skip( const std::vector< value_type >& w, size_type minskip, size_type maxskip, element_type wildcard) const
 	{
 		std::vector< size_type > uit;
 		std::vector< std::vector< size_type > > idx;
@@ -1409,19 +2976,33 @@ public:
 				++it;
 			}
 		}
-		
 		if(idx.size() != w.size())
 		{ // Only 0 or 1 subgram, USELESS to use this method!
 			return uit;
 		}
+		return join_skip_positions(idx, minskip, maxskip);
+	}
+
+	template <class V, class P>
+	typename std::vector< typename suffixarray<V,P>::size_type >
+	suffixarray<V,P>::join_skip_positions( std::vector< std::vector<size_type> >& idx, size_type minskip, size_type maxskip)
+	{
+		std::vector< size_type > uit;
+		if(idx.size() == 0)
+		{
+			return uit;
+		}
 		if(idx.size() == 1)
 		{
 			// USELESS but return the correct thing anyway
 			return idx.at(0);
 		}
-		if(idx.size() == 0)
+		for(size_type i = 0; i < idx.size(); i++)
 		{
-			return uit;
+			if(idx[i].empty())
+			{ // one of the parts does not occur, neither does the skipgram.
+				return uit;
+			}
 		}
 		
 		// vector of iterators (pointers) to efficiently walk all the sets of indexes.
@@ -1500,16 +3081,16 @@ public:
 		return uit;
 	}
 	
-	template <class V>
+	template <class V, class P>
 	typename V::size_type
-	suffixarray<V>::find_all_positions_skip_count( const std::vector< value_type >& w, size_type minskip, size_type maxskip, element_type wildcard) const
+	suffixarray<V,P>::find_all_positions_skip_count( const std::vector< value_type >& w, size_type minskip, size_type maxskip, element_type wildcard) const
 	{
 		return (size_type) find_all_positions_skip(w,minskip,maxskip,wildcard).size();
 	}
 	
-	template <class V>
+	template <class V, class P>
 	void 
-	suffixarray<V>::printlcpintervaltree()
+	suffixarray<V,P>::printlcpintervaltree()
 	{
 		std::stack< std::pair<int,interval> > s;
 		s.push(std::pair<int,interval>(0,getRootInterval()));
@@ -1546,57 +3127,63 @@ public:
 	}
 
 	
-	template <class V>
+	template <class V, class P>
 	void
-	suffixarray<V>::print(std::ostream &os) {
+	suffixarray<V,P>::print(std::ostream &os) {
 		// print the suffixtree on os.
 		// NOTE: Don't change unless you also change file reading! This function is used to print the suffixarray to a file.
-		for(int i = 0; i < (int) idx.size();i++)
+		for(size_type i = 0; i < idx.size();i++)
 		{
-			os << i << "\t";
-			os << idx.at(i) << "\t";
-			if(tabs.getlcp((size_type)i) == (size_type) -1)
-			{
-				os << "-\t";
-			}
-			else
-			{
-				os << tabs.getlcp((size_type)i) << "\t";
-			}
-			if(tabs.getup((size_type)i) == (size_type) -1)
-			{
-				os << "-\t";
-			}
-			else
-			{
-				os << tabs.getup((size_type)i) << "\t";
-			}
-			if(tabs.getdown((size_type)i) == (size_type) -1)
-			{
-				os << "-\t";
-			}
-			else
-			{
-				os << tabs.getdown((size_type)i) << "\t";
-			}
-			if(tabs.getnextl((size_type)i) == (size_type) -1)
-			{
-				os << "-\t";
-			}
-			else
-			{
-				os << tabs.getnextl((size_type)i) << "\t";
-			}
-			os << std::endl;
+			printline(os, i, idx.at(i));
 		}
+	}
+	
+	template <class V, class P>
+	void
+	suffixarray<V,P>::printline(std::ostream &os, size_type i, size_type sa) const {
+		os << i << "\t";
+		os << sa << "\t";
+		if(tabs.getlcp(i) == (size_type) -1)
+		{
+			os << "-\t";
+		}
+		else
+		{
+			os << tabs.getlcp(i) << "\t";
+		}
+		if(tabs.getup(i) == (size_type) -1)
+		{
+			os << "-\t";
+		}
+		else
+		{
+			os << tabs.getup(i) << "\t";
+		}
+		if(tabs.getdown(i) == (size_type) -1)
+		{
+			os << "-\t";
+		}
+		else
+		{
+			os << tabs.getdown(i) << "\t";
+		}
+		if(tabs.getnextl(i) == (size_type) -1)
+		{
+			os << "-\t";
+		}
+		else
+		{
+			os << tabs.getnextl(i) << "\t";
+		}
+		os << std::endl;
 	}	
 	
 	// operator<< writes t on os using the print function of the
 	// suffixtree class.
-	template <class V>
+	template <class V, class P>
 	std::ostream &
 	operator<<(std::ostream &os,
-			   const suffixarray<V> &t) {
+			   const suffixarray<V,P> &t) {
 		t.print(os);
 		return os;
 	}
@@ -0,0 +1,436 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: threadpool.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the threading helpers used by the suffix array package.
+// The class workstealingpool runs tasks on a fixed number of pthreads, each
+// thread owns a deque of tasks and steals from the others when it runs out.
+// The threads live as long as the pool and sleep while there is nothing to do.
+// parallelsort sorts a random access range on a workstealingpool.
+// Everything is defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __threadpool__
+#define __threadpool__
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+namespace ns_suffixarray {
+
+  // Runs tasks of type T on a number of threads.
+  // Each worker pops its own tasks from the back of its deque (depth-first, cache
+  // friendly) and steals from the front of the deques of the other workers
+  // (the oldest, and usually largest, tasks) when its own deque is empty.
+  // Tasks may push new tasks while running, run() returns once no task is left.
+  // The threads of workers 1... are started by the first run() and kept until the pool is
+  // destroyed, between and during runs a worker without tasks waits on a condition variable.
+  // Worker w is always the same thread, so a worker can set up its thread once (for instance
+  // pin it to a cpu) the first time it runs a task.
+  template <class T>
+    class workstealingpool {
+  public:
+    // Creates a pool with the given number of workers (at least 1).
+    workstealingpool(unsigned int threads);
+    ~workstealingpool();
+
+    // Returns the number of workers.
+    unsigned int
+      size() const { return (unsigned int) workers.size(); };
+
+    // Adds a task to the deque of worker w.
+    // Before run() use any w to distribute the initial tasks,
+    // from within a task use the worker that is running it.
+    void
+      push(unsigned int w, const T& task);
+
+    // Runs all tasks, calling f(task, w) on worker w, and returns when all
+    // tasks (including the ones pushed while running) are done.
+    // The calling thread acts as worker 0. Only one thread may call run() at a time.
+    template <class F>
+      void
+      run(F& f);
+
+  private:
+    // The deque of one worker and the lock protecting it.
+    class worker
+    {
+    public:
+      worker() { pthread_mutex_init(&lock, 0); };
+      ~worker() { pthread_mutex_destroy(&lock); };
+      std::deque<T> tasks;
+      pthread_mutex_t lock;
+    };
+
+    // Arguments of a started pthread.
+    class startargs
+    {
+    public:
+      workstealingpool<T>* pool;
+      unsigned int w;
+    };
+
+    // Pops the newest task of worker w.
+    bool
+      pop(unsigned int w, T& task);
+
+    // Steals the oldest task of any worker other than w.
+    bool
+      steal(unsigned int w, T& task);
+
+    // Runs tasks on worker w until none can be found.
+    void
+      drain(unsigned int w);
+
+    // The loop of the threads of workers 1...: sleep until a run has tasks, drain them.
+    void
+      work(unsigned int w);
+
+    // Starts the threads of workers 1...
+    void
+      startthreads();
+
+    // Calls the function of the running run() on a task.
+    template <class F>
+      static void
+      invoke(void* f, const T& task, unsigned int w) { (*(F*) f)(task, w); }
+
+    // Entry point of the pthreads.
+    static void*
+      start(void* args);
+
+    // Not copyable.
+    workstealingpool(const workstealingpool&);
+    workstealingpool& operator=(const workstealingpool&);
+
+    std::vector<worker*> workers;
+    std::vector<pthread_t> threads;
+    std::vector<char> started;
+    std::vector<startargs> args;
+
+    // Number of tasks pushed but not finished yet, and pushed but not taken yet.
+    volatile long pending;
+    volatile long queued;
+
+    // Protects the fields below, changed is signalled when tasks are pushed, when the
+    // last task is done and when the last busy worker runs out of tasks.
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    // The function of the running run(), 0 between runs.
+    void (*call)(void*, const T&, unsigned int);
+    void* function;
+    // Number of workers draining tasks and number of threads waiting on changed.
+    unsigned int busy;
+    unsigned int sleeping;
+    bool stopping;
+  };
+
+  // Sorts [begin,end) with cmp using the given number of threads.
+  // The range is cut in chunks which are sorted independently and then merged pairwise.
+  template <class I, class C>
+    void
+    parallelsort(I begin, I end, C cmp, unsigned int threads);
+
+	//
+	// workstealingpool functions:
+	//
+
+	template <class T>
+	workstealingpool<T>::workstealingpool(unsigned int n): pending(0), queued(0), call(0), function(0), busy(0), sleeping(0), stopping(false)
+	{
+		if(n == 0)
+		{
+			n = 1;
+		}
+		for(unsigned int i = 0; i < n; i++)
+		{
+			workers.push_back(new worker());
+		}
+		pthread_mutex_init(&lock, 0);
+		pthread_cond_init(&changed, 0);
+	}
+
+	template <class T>
+	workstealingpool<T>::~workstealingpool()
+	{
+		pthread_mutex_lock(&lock);
+		stopping = true;
+		pthread_cond_broadcast(&changed);
+		pthread_mutex_unlock(&lock);
+		for(unsigned int w = 1; w < started.size(); w++)
+		{
+			if(started[w])
+			{
+				pthread_join(threads[w], 0);
+			}
+		}
+		pthread_cond_destroy(&changed);
+		pthread_mutex_destroy(&lock);
+		for(unsigned int i = 0; i < workers.size(); i++)
+		{
+			delete workers[i];
+		}
+	}
+
+	template <class T>
+	void
+	workstealingpool<T>::push(unsigned int w, const T& task)
+	{
+		__sync_fetch_and_add(&pending, 1);
+		worker* wk = workers[w % workers.size()];
+		pthread_mutex_lock(&wk->lock);
+		wk->tasks.push_back(task);
+		pthread_mutex_unlock(&wk->lock);
+		__sync_fetch_and_add(&queued, 1);
+		pthread_mutex_lock(&lock);
+		if(sleeping > 0)
+		{
+			pthread_cond_broadcast(&changed);
+		}
+		pthread_mutex_unlock(&lock);
+	}
+
+	template <class T>
+	bool
+	workstealingpool<T>::pop(unsigned int w, T& task)
+	{
+		worker* wk = workers[w];
+		bool found = false;
+		pthread_mutex_lock(&wk->lock);
+		if(!wk->tasks.empty())
+		{
+			task = wk->tasks.back();
+			wk->tasks.pop_back();
+			__sync_fetch_and_sub(&queued, 1);
+			found = true;
+		}
+		pthread_mutex_unlock(&wk->lock);
+		return found;
+	}
+
+	template <class T>
+	bool
+	workstealingpool<T>::steal(unsigned int w, T& task)
+	{
+		for(unsigned int i = 1; i < workers.size(); i++)
+		{
+			worker* wk = workers[(w + i) % workers.size()];
+			bool found = false;
+			pthread_mutex_lock(&wk->lock);
+			if(!wk->tasks.empty())
+			{
+				task = wk->tasks.front();
+				wk->tasks.pop_front();
+				__sync_fetch_and_sub(&queued, 1);
+				found = true;
+			}
+			pthread_mutex_unlock(&wk->lock);
+			if(found)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template <class T>
+	void
+	workstealingpool<T>::drain(unsigned int w)
+	{
+		T task;
+		while(pop(w, task) || steal(w, task))
+		{
+			call(function, task, w);
+			// Only now the task is done, tasks it pushed were counted before.
+			if(__sync_sub_and_fetch(&pending, 1) == 0)
+			{
+				pthread_mutex_lock(&lock);
+				pthread_cond_broadcast(&changed);
+				pthread_mutex_unlock(&lock);
+			}
+		}
+	}
+
+	template <class T>
+	void
+	workstealingpool<T>::work(unsigned int w)
+	{
+		pthread_mutex_lock(&lock);
+		while(true)
+		{
+			while(!stopping && (call == 0 || __sync_fetch_and_add(&queued, 0) == 0))
+			{
+				sleeping++;
+				pthread_cond_wait(&changed, &lock);
+				sleeping--;
+			}
+			if(stopping)
+			{
+				break;
+			}
+			// While busy is not 0 run() does not return, so call and function stay valid.
+			busy++;
+			pthread_mutex_unlock(&lock);
+			drain(w);
+			pthread_mutex_lock(&lock);
+			if(--busy == 0)
+			{
+				pthread_cond_broadcast(&changed);
+			}
+		}
+		pthread_mutex_unlock(&lock);
+	}
+
+	template <class T>
+	void*
+	workstealingpool<T>::start(void* a)
+	{
+		startargs* s = (startargs*) a;
+		s->pool->work(s->w);
+		return 0;
+	}
+
+	template <class T>
+	void
+	workstealingpool<T>::startthreads()
+	{
+		threads.resize(workers.size());
+		started.assign(workers.size(), 0);
+		args.resize(workers.size());
+		for(unsigned int w = 1; w < workers.size(); w++)
+		{
+			args[w].pool = this;
+			args[w].w = w;
+			// If a thread can not be started the other workers simply do its share.
+			started[w] = pthread_create(&threads[w], 0, &workstealingpool<T>::start, &args[w]) == 0;
+		}
+	}
+
+	template <class T>
+	template <class F>
+	void
+	workstealingpool<T>::run(F& f)
+	{
+		if(started.empty())
+		{
+			startthreads();
+		}
+		pthread_mutex_lock(&lock);
+		call = &workstealingpool<T>::template invoke<F>;
+		function = &f;
+		pthread_cond_broadcast(&changed);
+		while(true)
+		{
+			pthread_mutex_unlock(&lock);
+			drain(0);
+			pthread_mutex_lock(&lock);
+			if(__sync_fetch_and_add(&pending, 0) == 0 && busy == 0)
+			{
+				break;
+			}
+			// Wait for a task to steal or for the others to finish.
+			while(__sync_fetch_and_add(&queued, 0) == 0 && !(__sync_fetch_and_add(&pending, 0) == 0 && busy == 0))
+			{
+				sleeping++;
+				pthread_cond_wait(&changed, &lock);
+				sleeping--;
+			}
+		}
+		call = 0;
+		function = 0;
+		pthread_mutex_unlock(&lock);
+	}
+
+	//
+	// parallelsort:
+	//
+
+	// Sorts or merges one part of the range given to parallelsort.
+	template <class I, class C>
+		class sortjob
+		{
+		public:
+			sortjob(C c): cmp(c) {};
+			// A task is [begin,middle,end) offsets, middle == end means sort, otherwise merge.
+			void operator()(const std::pair< std::pair<long,long>, long >& task, unsigned int)
+			{
+				I b = base + task.first.first;
+				I m = base + task.first.second;
+				I e = base + task.second;
+				if(m == e)
+				{
+					std::sort(b, e, cmp);
+				}
+				else
+				{
+					std::inplace_merge(b, m, e, cmp);
+				}
+			};
+			I base;
+			C cmp;
+		};
+
+	template <class I, class C>
+	void
+	parallelsort(I begin, I end, C cmp, unsigned int threads)
+	{
+		long n = (long) std::distance(begin, end);
+		if(threads <= 1 || n < 4096)
+		{
+			std::sort(begin, end, cmp);
+			return;
+		}
+		typedef std::pair< std::pair<long,long>, long > task;
+		sortjob<I,C> job(cmp);
+		job.base = begin;
+		workstealingpool<task> pool(threads);
+		// Sort chunks
+		long chunk = (n + threads - 1) / threads;
+		for(long b = 0; b < n; b += chunk)
+		{
+			long e = std::min(n, b + chunk);
+			pool.push((unsigned int) (b / chunk), task(std::pair<long,long>(b, e), e));
+		}
+		pool.run(job);
+		// Merge pairs of neighbouring chunks until one is left
+		while(chunk < n)
+		{
+			for(long b = 0; b + chunk < n; b += 2*chunk)
+			{
+				long e = std::min(n, b + 2*chunk);
+				pool.push((unsigned int) (b / (2*chunk)), task(std::pair<long,long>(b, b+chunk), e));
+			}
+			pool.run(job);
+			chunk *= 2;
+		}
+	}
+
+}
+#endif // __threadpool__
+// end of file: threadpool.h
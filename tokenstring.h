@@ -0,0 +1,56 @@
+// Part of the suffix array package by Herman Stehouwer
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// A list of token ids, as produced by the vocabulary in vocabulary.h.
+
+#ifndef __tokenstring__
+#define __tokenstring__
+
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+
+
+namespace std
+{
+
+class tokenstring: public vector<uint32_t> {
+  public:
+  tokenstring() {}
+  tokenstring(size_type n, uint32_t t):vector<uint32_t>(n, t) {}
+  tokenstring(const_iterator b, const_iterator e):vector<uint32_t>(b, e) {}
+
+
+  size_type
+    length( ) const { return size(); }
+
+  tokenstring
+    substr(size_type b, size_type n) const { return tokenstring(begin()+b, begin()+b+n); }
+};
+
+	inline ostream& operator<<(ostream& out, const tokenstring& ts)
+	{
+		for (vector<uint32_t>::const_iterator i=ts.begin(); i!=ts.end(); i++) {
+      out << *i << " ";
+    }
+		return out;
+	}
+
+
+}
+#endif // __tokenstring__
@@ -0,0 +1,455 @@
+///////////////////////////////////////////////////////////////////////////////*
+// Herman Stehouwer
+// j.h.stehouwer@uvt.nl
+////////////////////////////////////////////////////////////////////////////////
+// Filename: vocabulary.h
+////////////////////////////////////////////////////////////////////////////////
+// This file is part of the suffix array package.
+////////////////////////////////////////////////////////////////////////////////
+// Licenced under the GPLv3, see the LICENCE file.
+//
+// Copyright (C) 2010 Herman Stehouwer
+// //
+// // This program is free software: you can redistribute it and/or modify
+// // it under the terms of the GNU General Public License as published by
+// // the Free Software Foundation, either version 3 of the License, or
+// // (at your option) any later version.
+// //
+// // This program is distributed in the hope that it will be useful,
+// // but WITHOUT ANY WARRANTY; without even the implied warranty of
+// // MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// // GNU General Public License for more details.
+// //
+// // You should have received a copy of the GNU General Public License
+// // along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+// This file contains the token interning layer of the suffix array package.
+// The class vocabulary maps the words of a wordstring onto dense integer ids
+// and back. The class internedsuffixarray builds a suffixarray on the ids of
+// a wordstring corpus and answers queries given as wordstrings, so all suffix
+// comparisons during construction and lookup are integer comparisons.
+// Both classes are defined in the ns_suffixarray namespace.
+//////////////////////////////////////////////////////////////////////////////*/
+
+#ifndef __vocabulary__
+#define __vocabulary__
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <stdint.h>
+#include "wordstring.h"
+#include "tokenstring.h"
+#include "suffixarray.h"
+
+namespace ns_suffixarray {
+
+  // Maps words onto token ids and back.
+  // Ids are handed out in the sort order of the words (starting at 1), so a suffixarray
+  // over the ids sorts exactly like one over the words: the unique, largest last word of
+  // a corpus becomes the unique, largest last id.
+  class vocabulary {
+  public:
+    typedef std::tokenstring::value_type id_type;
+    typedef std::vector<std::string>::size_type size_type;
+
+    // The id of the wildcard, the default element of a tokenstring.
+    static const id_type wildcard = 0;
+    // The id of words that are not in the vocabulary, it never occurs in an interned corpus.
+    static const id_type unknown = (id_type) -1;
+
+    // Creates an empty vocabulary.
+    vocabulary() {};
+
+    // Creates the vocabulary of all words in corpus.
+    vocabulary(const std::wordstring& corpus);
+
+    // Creates the vocabulary of all words in a collection of documents.
+    vocabulary(const std::vector<std::wordstring>& documents);
+
+    // Creates the vocabulary stored by pack: n words, word i ends at ends[i] in chars.
+    vocabulary(const char* chars, const uint64_t* ends, size_type n);
+
+    // Returns the id of word, or unknown.
+    id_type
+      id(const std::string& word) const;
+
+    // Returns the word with id i, the empty string for wildcard and unknown.
+    const std::string&
+      word(id_type i) const;
+
+    // Translates the words in w to their ids.
+    // Words equal to wildcard become vocabulary::wildcard.
+    std::tokenstring
+      intern(const std::wordstring& w, const std::string& wildcard = std::string()) const;
+
+    // Translates the ids in t back to words.
+    std::wordstring
+      words(const std::tokenstring& t) const;
+
+    // Returns the number of words.
+    size_type
+      size() const { return table.size(); };
+
+    // Stores the words in chars, one after the other, and the end of each word in ends.
+    void
+      pack(std::string& chars, std::vector<uint64_t>& ends) const;
+
+  private:
+    // The words, sorted. Word table[i] has id i+1.
+    std::vector<std::string> table;
+
+    // Returned for ids without a word.
+    std::string none;
+  };
+
+  // A suffixarray over a wordstring corpus that is build and queried on token ids.
+  // The corpus is interned once, after construction the wordstring is not needed anymore.
+  // Queries are given as wordstrings and positions are positions in the corpus.
+  // The same rules as for suffixarray apply: the last word of the corpus must be unique
+  // and larger than all other words, and the wildcard (by default the empty string)
+  // should not occur in the corpus.
+  class internedsuffixarray {
+  public:
+    typedef suffixarray<std::tokenstring> index_type;
+    typedef index_type::size_type size_type;
+    // The type of the queries and of their elements.
+    typedef std::wordstring value_type;
+    typedef std::string element_type;
+
+    // Interns corpus and builds the suffixarray on its ids.
+    internedsuffixarray(const std::wordstring& corpus, sortmethod method = DEEPSHALLOW, unsigned int threads = 1);
+
+    // Loads the index stored in file f by saveindex, without the corpus. The suffixarray
+    // is used in place from the mapped file. On failure a message is written to std::cerr
+    // and size() returns 0.
+    internedsuffixarray(const std::string& f);
+
+    // Same, for an index file mapped in m, for instance a copy placed by numareplicas.
+    internedsuffixarray(const mappedfile& m);
+
+    // Stores the vocabulary, the interned corpus and the suffixarray in file f, returns
+    // false on failure. The suffixarray is stored in the binary format (see writebinary).
+    bool
+      saveindex(const std::string& f) const;
+
+    // Returns true if file f starts like a file written by saveindex.
+    static bool
+      isindex(const std::string& f);
+
+    // Returns the number of tokens of the corpus, 0 if loading failed.
+    size_type
+      size() const { return sarr.size(); };
+
+    // Same as suffixarray::find_position, w and wildcard are words.
+    size_type
+      find_position(const std::wordstring& w, const std::string& wildcard = std::string()) const;
+
+    // Same as suffixarray::find_all_positions, w and wildcard are words.
+    std::vector<size_type>
+      find_all_positions(const std::wordstring& w, const std::string& wildcard = std::string()) const;
+
+    // Same as suffixarray::find_all_positions_count, w and wildcard are words.
+    size_type
+      find_all_positions_count(const std::wordstring& w, const std::string& wildcard = std::string()) const;
+
+    // Same as suffixarray::find_all_positions_skip, the parts of w and wildcard are words.
+    std::vector<size_type>
+      find_all_positions_skip(const std::vector<std::wordstring>& w, size_type minskip, size_type maxskip, const std::string& wildcard = std::string()) const;
+
+    // Same as suffixarray::find_all_positions_skip_count, the parts of w and wildcard are words.
+    size_type
+      find_all_positions_skip_count(const std::vector<std::wordstring>& w, size_type minskip, size_type maxskip, const std::string& wildcard = std::string()) const;
+
+    // Returns the vocabulary, to translate ids back to words.
+    const vocabulary&
+      getvocabulary() const { return vocab; };
+
+    // Returns the interned corpus.
+    const std::tokenstring&
+      gettokens() const { return tokens; };
+
+    // Returns the suffixarray on the ids.
+    index_type&
+      getindex() { return sarr; };
+
+  private:
+    // Translates the parts of a skipgram.
+    std::vector<std::tokenstring>
+      intern(const std::vector<std::wordstring>& w, const std::string& wildcard) const;
+
+    // Not copyable, sarr refers to tokens.
+    internedsuffixarray(const internedsuffixarray&);
+    internedsuffixarray& operator=(const internedsuffixarray&);
+
+    // Returns the 8 byte magic starting an index file.
+    static const char*
+      indexmagic() { return "SUFINDEX"; };
+
+    // Helpers of the loading constructor, reading the sections of the index file.
+    static vocabulary
+      readvocabulary(const sectionreader& r);
+
+    static std::tokenstring
+      readtokens(const sectionreader& r);
+
+    static size_type
+      indexoffset(const sectionreader& r, const mappedfile& m);
+
+    // The index file, if loaded from one, and its sections. Both are empty otherwise.
+    mappedfile file;
+    sectionreader container;
+
+    // The order matters: sarr is build on tokens, which is build with vocab.
+    vocabulary vocab;
+    std::tokenstring tokens;
+    index_type sarr;
+  };
+
+	//
+	// vocabulary functions:
+	//
+
+	inline
+	vocabulary::vocabulary(const std::wordstring& corpus)
+	{
+		std::set<std::string> words(corpus.begin(), corpus.end());
+		table.assign(words.begin(), words.end());
+	}
+
+	inline
+	vocabulary::vocabulary(const std::vector<std::wordstring>& documents)
+	{
+		std::set<std::string> words;
+		for(size_type i = 0; i < documents.size(); i++)
+		{
+			words.insert(documents[i].begin(), documents[i].end());
+		}
+		table.assign(words.begin(), words.end());
+	}
+
+	inline
+	vocabulary::vocabulary(const char* chars, const uint64_t* ends, size_type n)
+	{
+		uint64_t begin = 0;
+		for(size_type i = 0; i < n; i++)
+		{
+			table.push_back(std::string(chars + begin, chars + ends[i]));
+			begin = ends[i];
+		}
+	}
+
+	inline
+	void
+	vocabulary::pack(std::string& chars, std::vector<uint64_t>& ends) const
+	{
+		chars.clear();
+		ends.clear();
+		for(size_type i = 0; i < table.size(); i++)
+		{
+			chars += table[i];
+			ends.push_back(chars.size());
+		}
+	}
+
+	inline
+	vocabulary::id_type
+	vocabulary::id(const std::string& w) const
+	{
+		std::vector<std::string>::const_iterator it = lower_bound(table.begin(), table.end(), w);
+		if(it == table.end() || *it != w)
+		{
+			return unknown;
+		}
+		return (id_type) (it - table.begin()) + 1;
+	}
+
+	inline
+	const std::string&
+	vocabulary::word(id_type i) const
+	{
+		if(i == wildcard || i == unknown || i > table.size())
+		{
+			return none;
+		}
+		return table[i-1];
+	}
+
+	inline
+	std::tokenstring
+	vocabulary::intern(const std::wordstring& w, const std::string& wc) const
+	{
+		std::tokenstring uit(w.size(), wildcard);
+		for(size_type i = 0; i < w.size(); i++)
+		{
+			if(w[i] != wc)
+			{
+				uit[i] = id(w[i]);
+			}
+		}
+		return uit;
+	}
+
+	inline
+	std::wordstring
+	vocabulary::words(const std::tokenstring& t) const
+	{
+		std::wordstring uit;
+		for(size_type i = 0; i < t.size(); i++)
+		{
+			uit.push_back(word(t[i]));
+		}
+		return uit;
+	}
+
+	//
+	// internedsuffixarray functions:
+	//
+
+	inline
+	internedsuffixarray::internedsuffixarray(const std::wordstring& corpus, sortmethod method, unsigned int threads):
+		vocab(corpus), tokens(vocab.intern(corpus, std::string())), sarr(tokens, method, threads)
+	{
+	}
+
+	inline
+	internedsuffixarray::internedsuffixarray(const std::string& f):
+		file(f), container(file.data(), file.size(), indexmagic(), index_type::binaryversion, sizeof(size_type)),
+		vocab(readvocabulary(container)), tokens(readtokens(container)), sarr(tokens, file, indexoffset(container, file))
+	{
+	}
+
+	inline
+	internedsuffixarray::internedsuffixarray(const mappedfile& m):
+		file(m), container(file.data(), file.size(), indexmagic(), index_type::binaryversion, sizeof(size_type)),
+		vocab(readvocabulary(container)), tokens(readtokens(container)), sarr(tokens, file, indexoffset(container, file))
+	{
+	}
+
+	inline
+	bool
+	internedsuffixarray::saveindex(const std::string& f) const
+	{
+		// Sections: the token ids, the characters of the words, the end of every word and
+		// the suffixarray, which sarr writes itself after the other sections.
+		std::string chars;
+		std::vector<uint64_t> ends;
+		vocab.pack(chars, ends);
+		sectionwriter w(indexmagic(), index_type::binaryversion, sizeof(size_type), tokens.size());
+		w.add(tokens.empty() ? 0 : &tokens[0], tokens.size() * sizeof(std::tokenstring::value_type));
+		w.add(chars.data(), chars.size());
+		w.add(ends.empty() ? 0 : &ends[0], ends.size() * sizeof(uint64_t));
+		w.add(0, sarr.binarysize());
+		std::ofstream myfile(f.c_str(), std::ios::out | std::ios::binary);
+		if(!myfile.is_open())
+		{
+			std::cerr << "Unable to open file" << std::endl;
+			return false;
+		}
+		bool ok = w.write(myfile) && sarr.writebinary(myfile);
+		myfile.close();
+		return ok && !myfile.fail();
+	}
+
+	inline
+	bool
+	internedsuffixarray::isindex(const std::string& f)
+	{
+		char magic[8];
+		std::ifstream myfile(f.c_str(), std::ios::in | std::ios::binary);
+		return myfile.read(magic, 8) && std::equal(magic, magic + 8, indexmagic());
+	}
+
+	inline
+	vocabulary
+	internedsuffixarray::readvocabulary(const sectionreader& r)
+	{
+		flatarray<char> chars;
+		flatarray<uint64_t> ends;
+		if(!r.good() || r.sections() != 4 || !r.view(1, chars) || !r.view(2, ends) || (!ends.empty() && ends.back() > chars.size()))
+		{
+			return vocabulary();
+		}
+		return vocabulary(chars.begin(), ends.begin(), ends.size());
+	}
+
+	inline
+	std::tokenstring
+	internedsuffixarray::readtokens(const sectionreader& r)
+	{
+		flatarray<std::tokenstring::value_type> ids;
+		if(!r.good() || r.sections() != 4 || !r.view(0, ids))
+		{
+			return std::tokenstring();
+		}
+		std::tokenstring uit;
+		uit.assign(ids.begin(), ids.end());
+		return uit;
+	}
+
+	inline
+	internedsuffixarray::size_type
+	internedsuffixarray::indexoffset(const sectionreader& r, const mappedfile& m)
+	{
+		// An offset past the end leaves sarr empty.
+		if(!r.good() || r.sections() != 4)
+		{
+			return m.size();
+		}
+		sectionreader::offset_type bytes;
+		return r.section(3, bytes) - m.data();
+	}
+
+	inline
+	internedsuffixarray::size_type
+	internedsuffixarray::find_position(const std::wordstring& w, const std::string& wildcard) const
+	{
+		return sarr.find_position(vocab.intern(w, wildcard), vocabulary::wildcard);
+	}
+
+	inline
+	std::vector<internedsuffixarray::size_type>
+	internedsuffixarray::find_all_positions(const std::wordstring& w, const std::string& wildcard) const
+	{
+		return sarr.find_all_positions(vocab.intern(w, wildcard), vocabulary::wildcard);
+	}
+
+	inline
+	internedsuffixarray::size_type
+	internedsuffixarray::find_all_positions_count(const std::wordstring& w, const std::string& wildcard) const
+	{
+		return sarr.find_all_positions_count(vocab.intern(w, wildcard), vocabulary::wildcard);
+	}
+
+	inline
+	std::vector<internedsuffixarray::size_type>
+	internedsuffixarray::find_all_positions_skip(const std::vector<std::wordstring>& w, size_type minskip, size_type maxskip, const std::string& wildcard) const
+	{
+		return sarr.find_all_positions_skip(intern(w, wildcard), minskip, maxskip, vocabulary::wildcard);
+	}
+
+	inline
+	internedsuffixarray::size_type
+	internedsuffixarray::find_all_positions_skip_count(const std::vector<std::wordstring>& w, size_type minskip, size_type maxskip, const std::string& wildcard) const
+	{
+		return sarr.find_all_positions_skip_count(intern(w, wildcard), minskip, maxskip, vocabulary::wildcard);
+	}
+
+	inline
+	std::vector<std::tokenstring>
+	internedsuffixarray::intern(const std::vector<std::wordstring>& w, const std::string& wildcard) const
+	{
+		std::vector<std::tokenstring> uit;
+		for(size_type i = 0; i < w.size(); i++)
+		{
+			uit.push_back(vocab.intern(w[i], wildcard));
+		}
+		return uit;
+	}
+
+}
+#endif // __vocabulary__
+// end of file: vocabulary.h
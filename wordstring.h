@@ -17,6 +17,9 @@
 // // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#ifndef __wordstring__
+#define __wordstring__
+
 #include <string>
 #include <vector>
 #include <stdio.h>
@@ -44,7 +47,6 @@ class wordstring: public vector<string> {
  {
 	string curr;
 	char c;
-	int count = 0;
 	while(in.good())
 	{
 		c = in.get();
@@ -55,7 +57,7 @@ class wordstring: public vector<string> {
 		else
 		{
 			if(curr.size() > 0)
-			{	++count;
+			{
 				vec.push_back(curr);
 			}
 			curr = string();
@@ -64,9 +66,7 @@ class wordstring: public vector<string> {
 	if(curr.size() > 0)
 	{
 		vec.push_back(curr);
-		++count;
 	}
-	cerr << "INTSTRING: READ IN " << count << " words" << endl;
 	return in;
 }
 
@@ -80,3 +80,4 @@ class wordstring: public vector<string> {
 
 
 }
+#endif // __wordstring__